@@ -19,6 +19,19 @@
 
 #define ACCESS_ONCE(x) (*(volatile typeof(x) *)&(x))
 
+/* 
+ * Keep the compiler from moving memory accesses across this point.
+ * Enough to publish data to an ISR on a single core. The native port
+ * runs 'interrupts' as signals or threads, so make it a real fence there.
+ */
+#if defined(CONFIG_ARCH_NATIVE)
+#define barrier() __sync_synchronize()
+#elif defined(CONFIG_TOOLCHAIN_GCC)
+#define barrier() __asm__ __volatile__("" : : : "memory")
+#else
+#define barrier()
+#endif
+
 #define min_t(type, x, y) ({					\
 			type __min1 = (x);			\
 			type __min2 = (y);			\
@@ -33,6 +33,16 @@ typedef enum { RF24_1MBPS = 0, RF24_2MBPS, RF24_250KBPS } rf24_datarate_e;
  */
 typedef enum { RF24_CRC_DISABLED = 0, RF24_CRC_8, RF24_CRC_16 } rf24_crclength_e;
 
+/**
+ * What the radio is left in once there's nothing more to send.
+ *
+ * Standby-I costs ~26uA and 130us to the next packet, standby-II
+ * (CE kept high) ~320uA and nothing, power down ~1uA and 1.5ms.
+ *
+ * For use with rf24_set_idle_mode()
+ */
+typedef enum { RF24_IDLE_STANDBY = 0, RF24_IDLE_STANDBY_II, RF24_IDLE_POWER_DOWN } rf24_idle_e;
+
 /**
  * Driver for nRF24L01(+) 2.4GHz Wireless Transceiver
  */
@@ -42,22 +52,70 @@ typedef enum { RF24_CRC_DISABLED = 0, RF24_CRC_8, RF24_CRC_16 } rf24_crclength_e
 #define RF24_P_VARIANT           (1<<1)
 #define RF24_ACK_PAYLOAD_AVAIL   (1<<2)
 #define RF24_DYNAMIC_PAYLOAD     (1<<3)
+#define RF24_ACK_PAYLOAD         (1<<4)
 
 
 #define rf24_is_wideband(rf24)         (rf24->flags & RF24_WIDE_BAND)
 #define rf24_is_p_variant(rf24)        (rf24->flags & RF24_P_VARIANT)
 
 #define rf24_has_dynamic_payload(rf24) (rf24->flags & RF24_DYNAMIC_PAYLOAD)
+
+#define RF24_SHADOW_REGS 9
+
+struct rf24_packet {
+	uint8_t len;
+	uint8_t data[32];
+};
+
+#ifdef CONFIG_LIB_RF24_ASYNC
+#define RF24_TXQ_SIZE CONFIG_LIB_RF24_TXQ_SIZE
+#endif
+
+#ifdef CONFIG_LIB_RF24_RXQ
+#define RF24_RXQ_SIZE  CONFIG_LIB_RF24_RXQ_SIZE
+#define RF24_RXQ_PIPES CONFIG_LIB_RF24_RXQ_PIPES
+
+struct rf24_rxq {
+	volatile uint8_t head;
+	volatile uint8_t tail;
+	struct rf24_packet slot[RF24_RXQ_SIZE];
+};
+#endif
+
 struct rf24 {
 	void    (*csn)(int level);
 	void    (*ce)(int level);
 	void    (*spi_set_speed)(int khz);
 	uint8_t (*spi_xfer)(uint8_t data);
+	/*
+	 * Optional. Clock len bytes at once, e.g. with SPI DMA, for the
+	 * data part of register and payload transactions. tx == NULL
+	 * means send 0xff, rx == NULL means discard.
+	 */
+	void    (*spi_xfer_block)(const uint8_t *tx, uint8_t *rx, int len);
+#ifdef CONFIG_LIB_RF24_ASYNC
+	/* Called from rf24_irq() for every rf24_send(), in order */
+	void    (*tx_done)(struct rf24 *r, int ok);
+#endif
 	/* private data below */
 	uint8_t flags;
 	uint8_t payload_size;
 	uint8_t ack_payload_length;
 	uint8_t pipe0_reading_address[5];
+	uint8_t idle_mode;
+	/* CONFIG to RF_SETUP, DYNPD and FEATURE, as last written */
+	uint8_t regs[RF24_SHADOW_REGS];
+#ifdef CONFIG_LIB_RF24_ASYNC
+	/* tail..load are in the chip's TX FIFO, load..head are waiting */
+	volatile uint8_t tx_head;
+	volatile uint8_t tx_load;
+	volatile uint8_t tx_tail;
+	struct rf24_packet txq[RF24_TXQ_SIZE];
+#endif
+#ifdef CONFIG_LIB_RF24_RXQ
+	struct rf24_rxq rxq[RF24_RXQ_PIPES];
+	unsigned int rx_dropped;         /* Queue full, or no queue for the pipe */
+#endif
 };
 
 
@@ -138,5 +196,21 @@ inline int rf24_is_ack_payload_available(struct rf24 *r)
 void rf24_what_happened(struct rf24 *r, int *tx_ok, int *tx_fail, int *rx_ready);
 int rf24_test_carrier(struct rf24 *r);
 int rf24_test_rpd(struct rf24 *r) ;
+void rf24_set_idle_mode(struct rf24 *r, rf24_idle_e mode);
+
+#ifdef CONFIG_LIB_RF24_ASYNC
+int rf24_send(struct rf24 *r, const void *buf, uint8_t len);
+int rf24_tx_pending(struct rf24 *r);
+#endif
+
+#ifdef CONFIG_LIB_RF24_RXQ
+int rf24_rx_drain(struct rf24 *r);
+int rf24_recv(struct rf24 *r, uint8_t pipe, void *buf, uint8_t len);
+int rf24_rx_pending(struct rf24 *r, uint8_t pipe);
+#endif
+
+#if defined(CONFIG_LIB_RF24_ASYNC) || defined(CONFIG_LIB_RF24_RXQ)
+void rf24_irq(struct rf24 *r);
+#endif
 
 #endif
@@ -0,0 +1,37 @@
+#ifndef LIB_CIRC_BUF_H
+#define LIB_CIRC_BUF_H
+
+/* 
+ * Ring buffer index helpers, borrowed from the linux kernel.
+ * size must be a power of 2. The producer only ever moves head,
+ * the consumer only ever moves tail, so a single producer and a 
+ * single consumer (e.g. an ISR and the main loop) need no locking. 
+ * One slot is always kept free to tell a full buffer from an empty one.
+ */
+
+/* Return count in buffer.  */
+#define CIRC_CNT(head,tail,size) (((head) - (tail)) & ((size)-1))
+
+/* Return space available, 0..size-1.  We always leave one free char
+   as a completely full buffer has head == tail, which is the same as
+   empty.  */
+#define CIRC_SPACE(head,tail,size) CIRC_CNT((tail),((head)+1),(size))
+
+/* Return count up to the end of the buffer.  Carefully avoid
+   accessing head and tail more than once, so they can change
+   underneath us without returning inconsistent results.  */
+#define CIRC_CNT_TO_END(head,tail,size) \
+	({int end = (size) - (tail); \
+	  int n = ((head) + end) & ((size)-1); \
+	  n < end ? n : end;})
+
+/* Return space available up to the end of the buffer.  */
+#define CIRC_SPACE_TO_END(head,tail,size) \
+	({int end = (size) - 1 - (head); \
+	  int n = (end + (tail)) & ((size)-1); \
+	  n <= end ? n : end+1;})
+
+/* Advance a head or tail index by n */
+#define CIRC_NEXT(idx,n,size) (((idx) + (n)) & ((size)-1))
+
+#endif
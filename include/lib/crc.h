@@ -0,0 +1,52 @@
+#ifndef LIB_CRC_H
+#define LIB_CRC_H
+
+#include <stdint.h>
+
+/*
+ * CRC-8 (polynomial 0x07), CRC16-CCITT (0x1021, XMODEM with 0 to
+ * start with, CCITT-FALSE with 0xffff) and CRC-32 (IEEE, as in zlib:
+ * start with 0, the result of one call goes into the next).
+ * The first two take and return the raw register, pass whatever
+ * initial value the protocol wants.
+ *
+ * Which implementation these are is a kcnf choice, see below.
+ */
+
+uint8_t crc8(uint8_t crc, const void *data, int len);
+uint16_t crc16_ccitt(uint16_t crc, const void *data, int len);
+uint16_t crc16_ccitt_byte(uint16_t crc, uint8_t b);
+uint32_t crc32(uint32_t crc, const void *data, int len);
+
+/* crc32() without the hardware, e.g. for interrupt handlers */
+uint32_t crc32_soft(uint32_t crc, const void *data, int len);
+
+/*
+ * The implementations themselves. Only the selected one is built,
+ * unless the benchmark wants them all.
+ */
+uint8_t crc8_bitwise(uint8_t crc, const void *data, int len);
+uint16_t crc16_ccitt_byte_bitwise(uint16_t crc, uint8_t b);
+uint16_t crc16_ccitt_bitwise(uint16_t crc, const void *data, int len);
+uint32_t crc32_bitwise(uint32_t crc, const void *data, int len);
+
+uint8_t crc8_nibble(uint8_t crc, const void *data, int len);
+uint16_t crc16_ccitt_byte_nibble(uint16_t crc, uint8_t b);
+uint16_t crc16_ccitt_nibble(uint16_t crc, const void *data, int len);
+uint32_t crc32_nibble(uint32_t crc, const void *data, int len);
+
+extern const uint8_t crc8_tab[256];
+extern const uint16_t crc16_ccitt_tab[256];
+extern const uint32_t crc32_tab[256];
+uint8_t crc8_table(uint8_t crc, const void *data, int len);
+uint16_t crc16_ccitt_byte_table(uint16_t crc, uint8_t b);
+uint16_t crc16_ccitt_table(uint16_t crc, const void *data, int len);
+uint32_t crc32_table(uint32_t crc, const void *data, int len);
+
+uint16_t crc16_ccitt_slice(uint16_t crc, const void *data, int len);
+uint32_t crc32_slice(uint32_t crc, const void *data, int len);
+
+/* Uses the CRC unit, don't call from interrupts then */
+uint32_t crc32_stm32(uint32_t crc, const void *data, int len);
+
+#endif
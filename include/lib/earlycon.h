@@ -6,12 +6,34 @@ struct early_console {
 	void (*txchar)(char c);
 	int (*rxchar)(void);
 	int (*havechar)(void);
+	/* 
+	 * Optional bulk versions of the above. Both may move less
+	 * than asked and return how much they did. rxbuf waits for
+	 * at least one byte.
+	 */
+	int (*txbuf)(const char *buf, int len);
+	int (*rxbuf)(char *buf, int len);
 };
 
 void early_console_checkinit();
 void early_putc(char c);
 int early_getc();
 int early_avail();
+int early_write(const char *buf, int len);
+int early_read(char *buf, int len);
+
+/*
+ * In non-blocking mode early_read() returns 0 and early_getc() -1
+ * when there's nothing to read, instead of waiting.
+ */
+void early_set_nonblock(int on);
+
+#ifdef CONFIG_LIB_EARLYCON_RX_RING
+/* For RX interrupts: queue received data, returns how much fit */
+int early_rx_push(const char *data, int len);
+/* Bytes dropped because the ring was full */
+unsigned int early_rx_lost();
+#endif
 
 extern struct early_console g_early_console;
 
@@ -49,6 +49,30 @@
 
 void printk_R(const char *fmt, ...);
 
+#ifdef CONFIG_LIB_PRINTK_RING
+
+struct printk_ring_stats {
+	unsigned int lost;       /* Messages dropped, the ring was full */
+	unsigned int lost_bytes;
+	unsigned int truncated;  /* Messages cut at CONFIG_LIB_PRINTK_RING_LINE, text or arguments */
+	unsigned int peak;       /* Most bytes ever waiting in the ring */
+};
+
+/* 
+ * With the ring, printk only queues messages. Drain them with one of:
+ * printk_flush() - from the main loop or idle, writes to the console
+ * printk_ring_getc() - from UART TX interrupt, -1 when it's empty 
+ * printk_ring_peek()/printk_ring_consume() - by DMA, in contiguous runs
+ * Use only one of them.
+ */
+void printk_flush();
+int printk_ring_getc();
+int printk_ring_peek(const char **data);
+void printk_ring_consume(int n);
+void printk_ring_stats(struct printk_ring_stats *s);
+
+#endif
+
 
 /* 
  * On AVR we use PROGMEM for printk fmt. 
@@ -60,6 +84,83 @@ void printk_P(const char *fmt, ...);
 #define printk(fmt, ...) printk_P(PSTR(fmt), ##__VA_ARGS__);
 #define panic_printk(fmt, ...) printk_P(fmt, ##__VA_ARGS__);
 
+#elif defined(CONFIG_LIB_PRINTK_BINARY)
+
+/*
+ * Deferred formatting. The format string goes to the printk_fmt
+ * section, which isn't loaded to flash, and printk only records its
+ * offset there and the raw arguments, each prefixed with its size:
+ * [ 0x1e | len | id (16 bit) | size | arg | size | arg ... ]
+ * 0x1f instead of 0x1e means there's the uptime after the id.
+ * Text from printk_R() goes as [ 0x1d | len | text ].
+ * scripts/printk_decode turns that back into text, given the ELF.
+ * The format has to be a string literal. Strings passed for %s are
+ * recorded as pointers and looked up in the ELF, so they'd better be
+ * constant.
+ */
+
+#include <string.h>
+#include <generic/macros.h>
+
+#define PRINTK_REC_TEXT 0x1d
+#define PRINTK_REC_BIN  0x1e
+#define PRINTK_REC_BIN_TS 0x1f
+
+#ifdef CONFIG_LIB_PRINTK_TIMESTAMP
+#define PRINTK_BIN_HDR (4 + __SIZEOF_INT__)
+#else
+#define PRINTK_BIN_HDR 4
+#endif
+
+struct printk_bin {
+	unsigned char len; /* Of the arguments */
+	unsigned char dropped; /* Arguments that didn't fit */
+	unsigned char buf[PRINTK_BIN_HDR + CONFIG_LIB_PRINTK_RING_LINE];
+};
+
+void printk_bin(const char *fmt, struct printk_bin *b);
+
+static inline void __pk_put(struct printk_bin *b, const void *v, unsigned char sz)
+{
+	unsigned char *p = &b->buf[PRINTK_BIN_HDR + b->len];
+	if (b->len + 1 + sz > CONFIG_LIB_PRINTK_RING_LINE) {
+		b->dropped++;
+		return;
+	}
+	*p++ = sz;
+	memcpy(p, v, sz);
+	b->len += 1 + sz;
+}
+
+/* +0 decays arrays and promotes small integers, like varargs do */
+#define __PK_ARG(b, a) {					\
+		typeof((a) + 0) __pk_v = (a);			\
+		__pk_put(&b, &__pk_v, sizeof(__pk_v));		\
+	}
+
+#define __PK_0(b)
+#define __PK_1(b, a) __PK_ARG(b, a)
+#define __PK_2(b, a, ...) __PK_ARG(b, a) __PK_1(b, __VA_ARGS__)
+#define __PK_3(b, a, ...) __PK_ARG(b, a) __PK_2(b, __VA_ARGS__)
+#define __PK_4(b, a, ...) __PK_ARG(b, a) __PK_3(b, __VA_ARGS__)
+#define __PK_5(b, a, ...) __PK_ARG(b, a) __PK_4(b, __VA_ARGS__)
+#define __PK_6(b, a, ...) __PK_ARG(b, a) __PK_5(b, __VA_ARGS__)
+#define __PK_7(b, a, ...) __PK_ARG(b, a) __PK_6(b, __VA_ARGS__)
+#define __PK_8(b, a, ...) __PK_ARG(b, a) __PK_7(b, __VA_ARGS__)
+
+#define __PK_NARGS(...) __PK_NARGS_(0, ##__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define __PK_NARGS_(_0, _1, _2, _3, _4, _5, _6, _7, _8, n, ...) n
+
+#define printk(fmt, ...) do {						\
+		static const char __pk_fmt[]				\
+			__attribute__((section("printk_fmt"), used)) = fmt; \
+		struct printk_bin __pk_b;				\
+		__pk_b.len = __pk_b.dropped = 0;			\
+		PPCAT(__PK_, __PK_NARGS(__VA_ARGS__))(__pk_b, ##__VA_ARGS__) \
+		printk_bin(__pk_fmt, &__pk_b);				\
+	} while (0);
+#define panic_printk(fmt, ...) printk_R(fmt, ##__VA_ARGS__);
+
 #else
 
 #define printk(fmt, ...) printk_R(fmt, ##__VA_ARGS__);
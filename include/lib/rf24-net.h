@@ -0,0 +1,109 @@
+#ifndef RF24_NET_H
+#define RF24_NET_H
+
+#include <stdint.h>
+#include <lib/RF24.h>
+
+/*
+ * A star network over rf24. Node 0 is the hub, 1 to 239 are leaves.
+ * Leaves only ever talk to the hub, which forwards what's for other
+ * leaves. Nodes share a 4 byte network address, the fifth byte of a
+ * node's address is its id, the hub listens on five pipes and leaf n
+ * sends to pipe 1 + (n - 1) % 5.
+ *
+ * Messages of up to RF24_NET_MTU bytes go out in fragments of up to
+ * 28 bytes, with a 4 byte header: source, destination, sequence
+ * number, flags. Sequence numbers count fragments per link. Up to
+ * 'window' fragments are in flight, the receiver returns how far it
+ * has got in the ack payloads, as (link sender, next sequence number)
+ * pairs for everybody it has lately heard from on that pipe. It
+ * only takes fragments in order, and the sender goes back to the
+ * first one not acked when a fragment fails, or nothing comes back.
+ * A sender new to a link, or whose last message on it failed, polls
+ * first and goes on from the sequence number the receiver reports,
+ * so neither end starting over is taken for fragments it has had.
+ *
+ * Everything is done from rf24_net_poll(): call it from the main
+ * loop, and whenever the IRQ line goes low. Don't call rf24_irq(),
+ * nor use the radio otherwise.
+ */
+
+#define RF24_NET_HUB       0
+#define RF24_NET_MAX_ID    239
+#define RF24_NET_HDR       4
+#define RF24_NET_FRAG      (32 - RF24_NET_HDR)
+#define RF24_NET_MTU       CONFIG_LIB_RF24_NET_MTU
+#define RF24_NET_PEERS     CONFIG_LIB_RF24_NET_PEERS
+#define RF24_NET_WINDOW    CONFIG_LIB_RF24_NET_WINDOW
+
+struct rf24_net_stats {
+	unsigned long frames;            /* Fragments sent, resends included */
+	unsigned long polls;             /* Sent only to fetch an ack */
+	unsigned long resends;           /* Times we went back */
+	unsigned long received;          /* Messages for us */
+	unsigned long forwarded;
+	unsigned long dropped;           /* Messages given up on, both ways */
+};
+
+/* The other end of a link, and what it's sending us */
+struct rf24_net_peer {
+	uint8_t id;                      /* 0xff: unused */
+	uint8_t pipe;                    /* It talks to us on */
+	uint8_t expect;                  /* Its next sequence number */
+	uint8_t tx_seq;                  /* Ours towards it */
+	uint8_t synced;                  /* And it's where it expects us */
+	uint8_t open;                    /* A message is being put together */
+	uint8_t ready;                   /* Which waits to be forwarded */
+	uint8_t src;
+	uint8_t dst;
+	uint16_t len;
+	unsigned long heard;
+	uint8_t buf[RF24_NET_MTU];
+};
+
+struct rf24_net {
+	/* Comes first. Set up and rf24_init() it before rf24_net_init() */
+	struct rf24 radio;
+	/* A whole message for us has arrived */
+	void (*recv)(struct rf24_net *n, uint8_t src, const void *msg, int len);
+	/* The one from rf24_net_send() is done, or given up on */
+	void (*sent)(struct rf24_net *n, int ok);
+	/* Fragments in flight, 1 to RF24_NET_WINDOW. 1 is stop-and-wait */
+	uint8_t window;
+	struct rf24_net_stats stats;
+	/* private data below */
+	uint8_t id;
+	uint8_t net[4];
+	uint8_t ack_loaded;              /* Pipes with an ack payload queued */
+	uint8_t ack_dirty;               /* Pipes whose ack payload is stale */
+	uint8_t ack_idle;                /* Frames since a loaded one was taken */
+	uint8_t ack_turn;                /* Pipe to load first, round robin */
+	unsigned long clock;
+	struct {
+		const uint8_t *msg;
+		uint16_t len;
+		uint8_t active;
+		uint8_t to;
+		uint8_t src;
+		uint8_t dst;
+		uint8_t base;            /* Sequence number of the first fragment */
+		uint8_t nfrag;
+		uint8_t next;            /* Next to send */
+		uint8_t top;             /* All before this one went out once */
+		uint8_t acked;           /* All before this one have arrived */
+		uint8_t failed;
+		uint8_t polls;
+		uint8_t tries;
+		uint8_t sync;            /* Asking where to start */
+		struct rf24_net_peer *link;
+		struct rf24_net_peer *fwd;
+	} tx;
+	struct rf24_net_peer peer[RF24_NET_PEERS];
+};
+
+void rf24_net_init(struct rf24_net *n, const uint8_t *net, uint8_t id);
+int rf24_net_send(struct rf24_net *n, uint8_t dst, const void *msg, int len);
+int rf24_net_busy(struct rf24_net *n);
+void rf24_net_poll(struct rf24_net *n);
+
+#endif
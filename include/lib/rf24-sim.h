@@ -0,0 +1,53 @@
+#ifndef RF24_SIM_H
+#define RF24_SIM_H
+
+#include <stdint.h>
+#include <lib/RF24.h>
+
+/*
+ * A behavioural nRF24L01+ model for the native arch. Each simulated
+ * radio sits behind the callbacks of a struct rf24 and decodes the
+ * SPI commands byte by byte: registers, the TX and RX FIFOs, ack
+ * payloads, Enhanced ShockBurst auto-ack and retransmit, dynamic
+ * payloads. The radios share one air, with configurable loss and
+ * latency, and collide when they talk over each other.
+ *
+ * Time is virtual and shared by all of them: SPI bytes, delay_us()
+ * and rf24_sim_sleep() advance it, nothing else does.
+ */
+
+struct rf24_sim_stats {
+	unsigned long spi_bytes;
+	unsigned long transactions;
+	unsigned long irqs;
+	unsigned long sent;              /* Packets on air, acks included */
+	unsigned long retransmits;
+	unsigned long lost;              /* To loss, collisions or full FIFOs */
+	unsigned long delivered;         /* Into an RX FIFO */
+	unsigned long errors;            /* The driver did something wrong */
+};
+
+struct rf24_sim_air {
+	unsigned int loss;               /* Per 1000 packets */
+	unsigned long latency_ns;        /* Added to every packet */
+	unsigned int spi_khz;
+	unsigned long long now;          /* ns */
+	struct rf24_sim_stats stats;
+};
+
+extern struct rf24_sim_air rf24_sim_air;
+
+#define RF24_SIM_RADIOS 32
+
+/*
+ * Creates radio number 'n' (0 to RF24_SIM_RADIOS - 1) in
+ * its power-on state and fills in the callbacks of r. irq, if not
+ * NULL, is called like an interrupt handler when its IRQ line goes
+ * low, never nested in another one.
+ */
+void rf24_sim_attach(int n, struct rf24 *r, void (*irq)(struct rf24 *r));
+
+/* Wait for an interrupt: runs the air until one, or until 'max_ns' */
+void rf24_sim_sleep(unsigned long long max_ns);
+
+#endif
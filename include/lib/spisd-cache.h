@@ -0,0 +1,55 @@
+#ifndef SPISD_CACHE_H
+#define SPISD_CACHE_H
+
+#include <lib/spisd.h>
+
+/*
+ * Set associative write-back cache of 512 byte blocks in front of
+ * an sd_card. Block n lives in set n % SETS, in the least recently
+ * used of its WAYS lines. Writes only mark lines dirty; they go to
+ * the card on eviction or sd_cache_flush(), consecutive blocks
+ * merged into one multiple block write.
+ */
+
+#define SD_CACHE_SETS CONFIG_LIB_SPISD_CACHE_SETS
+#define SD_CACHE_WAYS CONFIG_LIB_SPISD_CACHE_WAYS
+
+#define SD_CACHE_VALID (1<<0)
+#define SD_CACHE_DIRTY (1<<1)
+
+struct sd_cache_line {
+	unsigned long block;
+	unsigned long stamp;             /* Last use, for LRU */
+	char flags;
+	char data[512];
+};
+
+struct sd_cache_stats {
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long evictions;         /* Of dirty lines */
+	unsigned long writebacks;        /* Blocks written to the card */
+	unsigned long runs;              /* Write commands they took */
+	unsigned long erases;
+};
+
+struct sd_cache {
+	struct sd_card *sd;
+	unsigned long tick;
+	struct sd_cache_stats stats;
+	struct sd_cache_line line[SD_CACHE_SETS][SD_CACHE_WAYS];
+};
+
+void sd_cache_init(struct sd_cache *c, struct sd_card *sd);
+
+/* Same as sd_read()/sd_write(), 0 on success or the card's response */
+unsigned char sd_cache_read(struct sd_cache *c, unsigned long block, char *buf);
+unsigned char sd_cache_write(struct sd_cache *c, unsigned long block, const char *buf);
+
+/* Writes every dirty line back, the cached data stays */
+unsigned char sd_cache_flush(struct sd_cache *c);
+
+/* Drops everything, dirty lines included */
+void sd_cache_invalidate(struct sd_cache *c);
+
+#endif
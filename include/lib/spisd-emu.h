@@ -0,0 +1,35 @@
+#ifndef SPISD_EMU_H
+#define SPISD_EMU_H
+
+#include <lib/spisd.h>
+
+/*
+ * A fake SDHC card for the native arch. It sits behind the
+ * cs/xfer callbacks of struct sd_card and talks SPI mode byte by
+ * byte, keeping the blocks in a sparse image file. Timing is
+ * simulated, see CONFIG_LIB_SPISD_EMU_*_US, and shows up in ns.
+ */
+
+struct sd_emu_stats {
+	unsigned long commands;
+	unsigned long blocks_read;
+	unsigned long blocks_written;
+	unsigned long blocks_erased;
+	unsigned long long bytes;        /* Clocked over SPI */
+	unsigned long long busy_bytes;   /* ...of them polling a busy card */
+	unsigned long long ns;           /* Virtual time on the bus */
+};
+
+extern struct sd_emu_stats sd_emu_stats;
+
+/*
+ * Creates or reuses an image of 'blocks' blocks, a multiple of 1024
+ * as the CSD counts in 512K units. Resets the stats.
+ */
+int sd_emu_open(const char *path, unsigned long blocks);
+void sd_emu_close(void);
+
+/* Fills in the bus callbacks, sd_init() it afterwards */
+void sd_emu_attach(struct sd_card *sd);
+
+#endif
@@ -19,6 +19,15 @@ struct sd_card {
         void          (*cs)(int select);
         unsigned char (*xfer)(unsigned char b);
         void          (*set_speed)(int speed);
+        /* 
+         * Optional. Clock len bytes at once, e.g. with SPI DMA.
+         * tx == NULL means send 0xff, rx == NULL means discard. 
+         * If xfer_wait is there too, xfer_block may return as soon 
+         * as the transfer is started and xfer_wait waits for it
+         * to complete.
+         */
+        void          (*xfer_block)(const char *tx, char *rx, int len);
+        void          (*xfer_wait)(void);
         char          flags;
         char          version;
         char          card_type;
@@ -112,4 +121,27 @@ unsigned char sd_multiread (struct sd_card *sd,
 			    unsigned long block_count,
 			    char* buffer);
 
+/*
+ * Reads block_count blocks in one go, handing each one to consume()
+ * as soon as it's in. buf is two blocks (1024 bytes), the next one
+ * is being clocked into one half while consume() has the other.
+ * A non-zero return from consume() stops the transfer.
+ */
+unsigned char sd_read_stream(struct sd_card *sd,
+			     unsigned long start_block,
+			     unsigned long block_count,
+			     char* buf,
+			     int (*consume)(void *arg, unsigned long block, char *data),
+			     void *arg);
+
+/*
+ * Writes block_count blocks with one command, produce() returns
+ * the data for each, in order. See sd_read_stream().
+ */
+unsigned char sd_write_stream(struct sd_card *sd,
+			      unsigned long start_block,
+			      unsigned long block_count,
+			      const char *(*produce)(void *arg, unsigned long block),
+			      void *arg);
+
 #endif
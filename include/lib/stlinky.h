@@ -1,6 +1,7 @@
 #ifndef STLINKY_H
 #define STLINKY_H
 
+#ifndef CONFIG_LIB_STLINKY_V2
 
 #define STLINKY_MAGIC 0xDEADF00D
 
@@ -19,8 +20,36 @@ struct stlinky {
 	char rxbuf[CONFIG_LIB_STLINKY_BSIZE];
 } __attribute__ ((packed));;
 
+#else
+
+/*
+ * v2: two rings. The debugger finds the structure by its magic,
+ * like v1, then reads the sizes. Indices run free, mask them with
+ * size - 1. Every field is a single aligned word access, the side
+ * that owns an index is the only one that writes it:
+ * txhead, rxtail - target; txtail, rxhead - debugger.
+ */
+
+#define STLINKY_MAGIC 0xDEADF00E
+
+struct stlinky {
+	uint32_t magic;            /* [3:0] */
+	uint16_t txsize;           /* [5:4] power of 2 */
+	uint16_t rxsize;           /* [7:6] power of 2 */
+	uint32_t txhead;           /* [11:8] */
+	uint32_t txtail;           /* [15:12] */
+	uint32_t rxhead;           /* [19:16] */
+	uint32_t rxtail;           /* [23:20] */
+	char txbuf[CONFIG_LIB_STLINKY_TXSIZE];
+	char rxbuf[CONFIG_LIB_STLINKY_RXSIZE];
+} __attribute__ ((aligned (4)));
+
+#endif
+
+/* Sends everything, waits for the debugger only while there's no room */
 int stlinky_tx(volatile struct stlinky* st, const char* buf, int sz);
 
+/* Waits for data, then takes up to sz bytes of it */
 int stlinky_rx(volatile struct stlinky* st, char* buf, int sz);
 
 void stlinky_wait_for_terminal(volatile struct stlinky* st);
@@ -30,4 +59,3 @@ int stlinky_avail(volatile struct stlinky* st);
 extern volatile struct stlinky g_stlinky_term;
 
 #endif
-
@@ -6,37 +6,34 @@
   */
 
 #define TIME_OVER 1 // do not change. hm... doesn't matter :)
+#define TMGR_NO_DEADLINE (~0U) // tmgr_next_deadline(): nothing is pending
 
 /** @}
   */
 
-/** @defgroup Config section
-  * @{
-  */
-#ifndef TASKS_CONFIG
-// Config: if defined, you can add only 1 handler for 1 function-listener
-// Optimises the work of the task manager if you use it for delayed looped run
-#define REM_HANDLER_IS_DEFINED
-
-#endif
-/** @}
-  */
-
-
 /** @defgroup About variables
   * @{
   */
 
-// Number of registered handlers
-
 // Typedef for handler data structure
+// A handler_t is also the handle to cancel or move a pending timer with,
+// so one handler_t can be pending only once. Use one per timer.
 typedef struct hndlr{
     void (*handler)(void); // address of handler function (void)
     unsigned int uptime; // uptime to run
-    // private: address of the next structure in list
+    void (*func)(void *arg); // if set, called with arg instead of handler
+    void * arg;
+    unsigned int period; // if not 0, rerun every period ticks after uptime
+    // private: timing wheel slot linkage
     struct hndlr * next;
+    struct hndlr ** pprev; // NULL when the handler is not pending
 } handler_t;
 
+// Handlers must start out zeroed, tmgr_register() trusts pprev. Globals and
+// statics are, for one on the stack or the heap use TMGR_HANDLER_INIT or
+// tmgr_handler_init() before anything else
+#define TMGR_HANDLER_INIT { 0 }
+
 /** @}
   */
 
@@ -44,16 +41,36 @@ typedef struct hndlr{
   * @{
   */
 
+void tmgr_handler_init(handler_t * data); // zeroes data, not while it's pending
+
 // Returns 0 in normal case, or 1 (TIME_OVER constant) if system uptime is above than handler's start time
 int tmgr_register(handler_t * data);   // NOTE: It's better if data structure declared in global scope
-                                         // And, DO NOT CHANGE STRUCTURES OF REGISTERED HANDLERS!
-                                         // TODO: remove this limitation
+                                         // Registering a pending handler again just moves it to the new uptime
+
+// Runs data every period ticks, starting period ticks from now. Deadlines
+// are advanced by period from the previous deadline, so they never drift
+int tmgr_register_periodic(handler_t * data, unsigned int period);
+
+void tmgr_cancel(handler_t * data);    // Removes a pending handler, does nothing if it is not pending
+                                         // Safe to call from a handler, even for itself
 
 void tmgr_tick(void); // add this function to SysTick timer / another simple timer / just in forever loop :)
 
 void sleep_ticks(unsigned int ticks); // sleep for n timer ticks
 
 unsigned int tmgr_get_uptime();
+
+// Tell tmgr the tick rate. If it was set before, the remaining time and
+// period of pending handlers are rescaled so they still fire on time
+void tmgr_set_rate(unsigned int nrate);
+
+// Tickless mode (CONFIG_LIB_TMGR_TICKLESS). Instead of calling tmgr_tick() on
+// every tick, do this in the idle loop:
+//   tmgr_advance(ticks elapsed since the last call);
+//   program a timer compare tmgr_next_deadline() ticks ahead and sleep
+// Anything registered meanwhile is picked up the next time the loop goes idle.
+unsigned int tmgr_next_deadline(void); // ticks that may pass before tmgr has work to do
+void tmgr_advance(unsigned int ticks);  // account for elapsed ticks, runs everything that expired
 /** @}
   */
 
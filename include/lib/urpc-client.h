@@ -0,0 +1,77 @@
+#ifndef URPC_CLIENT_H
+#define URPC_CLIENT_H
+
+/*
+ * Host side of urpc over the serial transport. Talks to a device
+ * over any fd (a tty, a pty, a socket), finds out its id and size
+ * widths and its objects, then calls methods. Calls don't wait for
+ * replies, so any number of them can be in flight.
+ */
+
+struct urpc_client_object {
+	unsigned long id;
+	char flags;
+	char* name;
+	char* data;
+	char* reply;
+};
+
+struct urpc_reply {
+	int has_id;          /* 0 for frames without an id */
+	unsigned long id;
+	const char* data;    /* Valid until the next urpc_client_reply() */
+	int len;
+};
+
+struct urpc_client {
+	int fd;
+	/* From the mode tag */
+	unsigned char szb;
+	unsigned char idb;
+	char endian;
+	unsigned char features;
+	struct urpc_client_object* objs;
+	int nobjs;
+	/* Wire traffic, bytes */
+	unsigned long tx_bytes;
+	unsigned long rx_bytes;
+	/* private */
+	unsigned char* rx;
+	int rx_len;
+	int rx_size;
+	int rx_used;         /* Size of the last returned frame, dropped on next read */
+	const unsigned char* bcur; /* Unread part of a batch reply */
+	int bleft;
+	unsigned char* tx;   /* Frame being sent */
+	int tx_size;
+	unsigned char* batch; /* Calls of the batch being built */
+	int batch_len;
+	int batch_size;
+	int batching;
+};
+
+/*
+ * Run discovery. szb is the device's urpc_size_t width, 0 to probe.
+ * Returns 0 when the object table is complete.
+ */
+int urpc_client_open(struct urpc_client* c, int fd, int szb, int timeout_ms);
+void urpc_client_close(struct urpc_client* c);
+
+/* Object id by name, -1 if there's none */
+long urpc_client_find(struct urpc_client* c, const char* name);
+
+/* Send a call, or add it to the batch. Returns 0 or -1 on write errors */
+int urpc_client_call(struct urpc_client* c, unsigned long id,
+		     const void* data, int len);
+
+/* Calls between these go out as one batch packet */
+void urpc_client_batch_begin(struct urpc_client* c);
+int urpc_client_batch_end(struct urpc_client* c);
+
+/*
+ * Next incoming packet. Batch replies are returned one call at a time.
+ * Returns 1 if there's one, 0 on timeout, -1 on errors.
+ */
+int urpc_client_reply(struct urpc_client* c, struct urpc_reply* r, int timeout_ms);
+
+#endif
@@ -1,6 +1,8 @@
 #ifndef URPC_H
 #define URPC_H
 
+#include <stdint.h>
+
 /* Packet is method call */ 
 #define FLAG_URPC_METHOD       1
 /* Packet is event data */
@@ -41,7 +43,24 @@ typedef uint32_t urpc_id_t;
 #define ENDIANNESS '?'
 #endif
 
-#define URPC_MODE_TAG { STAG , ITAG, ENDIANNESS, 0x0 }
+/* Feature bits, last byte of the mode tag */
+#ifdef CONFIG_URPC_BATCH
+#define URPC_FEAT_BATCH 0x1
+#else
+#define URPC_FEAT_BATCH 0x0
+#endif
+#define URPC_FEAT_CRC16 0x2 /* Set by transports that use it */
+
+#define URPC_MODE_TAG { STAG , ITAG, ENDIANNESS, URPC_FEAT_BATCH }
+
+/* 
+ * The highest id is reserved for batches. A batch packet carries 
+ * several calls, each one prefixed with its size:
+ * [ URPC_ID_BATCH | size | id | data | size | id | data | ... ]
+ * where size covers id and data. Replies sent with urpc_respond()
+ * come back the same way, in a single batch packet when they fit.
+ */
+#define URPC_ID_BATCH ((urpc_id_t) ~0)
 
 
 /* 'data' actually serves to be the pointer to the first byte 
@@ -53,29 +72,95 @@ struct urpc_packet {
 	unsigned char data;
 };
 
+/* Stream events, see urpc_object.stream */
+#define URPC_STREAM_BEGIN 0 /* len is the size of the data to come */
+#define URPC_STREAM_DATA  1 /* Next piece of the data */
+#define URPC_STREAM_END   2 /* All there, checksum is fine */
+#define URPC_STREAM_ABORT 3 /* Broken, forget what you've got */
+
 struct urpc_object {
 	const char flags;
 	const char* name;
 	const char* data;
 	const char* reply;
 	void (*method)(char* data); 
+	/* 
+	 * Optional. If set and the transport supports it, calls are 
+	 * passed here piece by piece in the receive context (usually
+	 * ISR) instead of being queued for 'method'. There's no limit
+	 * on the data size then. 
+	 */
+	void (*stream)(int event, const char* data, int len);
 };
 
 #define URPC_OBJ_ID(obj)						\
 	(((char*)obj - (char*)&urpc_exports[0])/sizeof(struct urpc_object))
 
-/* Transport layer should implement these*/
-void urpc_tx_data(struct urpc_object* obj, char* data, int sz);
-void urpc_tx_object(struct urpc_object* obj);
-/* Callback */
-void urpc_handle_incoming(struct urpc_packet* pck);
+#define URPC_METHOD(_name, _data, _reply, _method)			\
+	{ .flags = FLAG_URPC_METHOD, .name = _name, .data = _data,	\
+	  .reply = _reply, .method = _method }
+
+#define URPC_EVENT(_name, _data)					\
+	{ .flags = FLAG_URPC_EVENT, .name = _name, .data = _data,	\
+	  .reply = "" }
+
+/* 
+ * Defines the export table. Use it once, at file scope:
+ * URPC_EXPORTS(
+ *	URPC_METHOD("led", "b", "", led_set),
+ *	URPC_EVENT("button", "b")
+ * );
+ * The number of entries is known at compile time, so calls with 
+ * an id out of range are dropped. Building fails if the table 
+ * doesn't fit urpc_id_t.
+ */
+#define URPC_EXPORTS(...)						\
+	struct urpc_object urpc_exports[] = { __VA_ARGS__, { 0 } };	\
+	const urpc_id_t urpc_nexports =					\
+		sizeof(urpc_exports) / sizeof(urpc_exports[0]) - 1;	\
+	typedef char urpc_exports_fit_id[				\
+		(sizeof(urpc_exports) / sizeof(urpc_exports[0]) - 1 <	\
+		 (unsigned long) URPC_ID_BATCH) ? 1 : -1]
+
+/* 
+ * Transport layer should implement these. The ones returning int
+ * return -1 if the frame can't be sent right now (e.g. the transmit
+ * queue is full), nothing is sent then.
+ */
+int urpc_tx_data(struct urpc_object* obj, char* data, int sz);
+int urpc_tx_object(struct urpc_object* obj);
+int urpc_tx_batch(char* data, int sz); /* packet with URPC_ID_BATCH */
+/* Same as urpc_tx_data, with the data passed in pieces adding up to sz */
+int urpc_tx_stream_begin(struct urpc_object* obj, int sz);
+void urpc_tx_stream(const char* data, int sz);
+void urpc_tx_stream_end();
+/* Callback, sz is the packet size including the id */
+void urpc_handle_incoming(struct urpc_packet* pck, urpc_size_t sz);
+/* Packets lost due to a full queue so far */
+unsigned int urpc_dropped();
 
 
 
 void urpc_discovery();
 void urpc_loop(); /* Processing loop */
+/* Reply to the call being processed, from within its method */
 void urpc_respond(char* data, int sz);
 
 extern struct urpc_object urpc_exports[];
+extern const urpc_id_t urpc_nexports;
+
+#ifdef CONFIG_URPC_T_SERIAL
+/* Serial transport, feed it with what you receive */
+void gotchar(char b);
+void gotdata(const char* data, int len);
+#ifdef CONFIG_URPC_TX_QUEUE
+void urpc_serial_tx_start(); /* You provide this one */
+/* For the TX empty ISR, -1 when there's nothing more to send */
+int urpc_serial_tx_getchar();
+/* For DMA: contiguous bytes ready at *data, call _done() once sent */
+int urpc_serial_tx_pending(const char** data);
+void urpc_serial_tx_done(int n);
+#endif
+#endif
 
 #endif
@@ -2,14 +2,35 @@
 #define XMODEM_H
 
 
+/*
+ * getchar() waits for a byte. char_avail() and delay_1s() give the
+ * timeouts: a second per byte, after which the packet is NAKed, and
+ * they're used to drop garbage after a bad packet. Without them the
+ * receiver just blocks.
+ *
+ * Each packet is ACKed as soon as it checks out and then given to
+ * writer(), negative return cancels the transfer. If writer_wait is
+ * set, writer() may return while it's still working on the buffer,
+ * the next packet goes into another one meanwhile and writer_wait()
+ * is called before the next writer(), and before xmodem_receive()
+ * returns, error or not. Without it, the next packet has to be
+ * buffered by the UART driver while writer() runs.
+ */
 struct xmodem_receiver {
 	int (*getchar)(void); 
 	void (*putchar)(char c);
 	int (*char_avail)();
 	void (*delay_1s)(); 
 	int (*writer)(char* buffer, int size);
+	void (*writer_wait)(void);
 };
 
+/*
+ * The same, only reader() fills the buffer with up to size bytes of
+ * what's to be sent and returns how many, 0 at the end, negative on
+ * error. It's asked for 1K at a time, for the next packet while the
+ * current one is going out.
+ */
 struct xmodem_transmitter {
 	int (*getchar)(void); 
 	void (*putchar)(char c);
@@ -18,7 +39,9 @@ struct xmodem_transmitter {
 	int (*reader)(char* buffer, int size);
 };
 
+/* Bytes received, or < 0 on error */
 int xmodem_receive(struct xmodem_receiver *rx);
+/* Bytes sent (without padding), or < 0 on error */
 int xmodem_transmit(struct xmodem_transmitter *tx);
 
 #endif
@@ -13,6 +13,9 @@
 
 #define ANTARES_DISABLE_IRQS()  EA=0
 #define ANTARES_ENABLE_IRQS()   EA=1
+/* For code that may run with interrupts off already, e.g. in an ISR */
+#define ANTARES_IRQ_SAVE(flags) do { flags = EA; EA = 0; } while (0)
+#define ANTARES_IRQ_RESTORE(flags) EA = flags
 
 #define get_system_clock()    CONFIG_F_CPU
 #define set_system_clock(clk) 
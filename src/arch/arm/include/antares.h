@@ -50,6 +50,9 @@
 
 #define ANTARES_DISABLE_IRQS() __disable_irq()
 #define ANTARES_ENABLE_IRQS() __enable_irq()
+/* For code that may run with interrupts off already, e.g. in an ISR */
+#define ANTARES_IRQ_SAVE(flags) do { flags = __get_PRIMASK(); __disable_irq(); } while (0)
+#define ANTARES_IRQ_RESTORE(flags) __set_PRIMASK(flags)
 
 
 extern uint32_t SystemCoreClock;
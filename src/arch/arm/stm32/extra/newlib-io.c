@@ -2,55 +2,21 @@
 #include <sys/stat.h>
 #include <sys/times.h>
 #include <sys/unistd.h>
+#include <generic/macros.h>
 #include "stm32f10x_usart.h"
 
-#define STDOUT_USART CONFIG_STM32_UARTIO_PORT
-#define STDERR_USART CONFIG_STM32_UARTIO_PORT
-#define STDIN_USART CONFIG_STM32_UARTIO_PORT
-
-#ifndef STDOUT_USART
-#define STDOUT_USART 1
-#endif
-
-#ifndef STDERR_USART
-#define STDERR_USART 1
-#endif
-
-#ifndef STDIN_USART
-#define STDIN_USART 1
-#endif
+/* stdout, stderr and stdin all go to the same one */
+#define UARTIO PPCAT(USART, CONFIG_STM32_UARTIO_PORT)
 
 int _write(int file, char *ptr, int len) {
     int n;
     switch (file) {
-    case STDOUT_FILENO: /*stdout*/
-        for (n = 0; n < len; n++) {
-#if STDOUT_USART == 1
-            while ((USART1->SR & USART_FLAG_TC) == (uint16_t)RESET) {}
-            USART1->DR = (*ptr++ & (uint16_t)0x01FF);
-#elif  STDOUT_USART == 2
-            while ((USART2->SR & USART_FLAG_TC) == (uint16_t) RESET) {
-            }
-            USART2->DR = (*ptr++ & (uint16_t) 0x01FF);
-#elif  STDOUT_USART == 3
-            while ((USART3->SR & USART_FLAG_TC) == (uint16_t)RESET) {}
-            USART3->DR = (*ptr++ & (uint16_t)0x01FF);
-#endif
-        }
-        break;
-    case STDERR_FILENO: /* stderr */
+    case STDOUT_FILENO:
+    case STDERR_FILENO:
+        /* Back to back, TXE is enough */
         for (n = 0; n < len; n++) {
-#if STDERR_USART == 1
-            while ((USART1->SR & USART_FLAG_TC) == (uint16_t)RESET) {}
-            USART1->DR = (*ptr++ & (uint16_t)0x01FF);
-#elif  STDERR_USART == 2
-            while ((USART2->SR & USART_FLAG_TC) == (uint16_t) RESET) {
-            }
-            USART2->DR = (*ptr++ & (uint16_t) 0x01FF);
-#elif  STDERR_USART == 3
-            while ((USART3->SR & USART_FLAG_TC) == (uint16_t)RESET) {}
-            USART3->DR = (*ptr++ & (uint16_t)0x01FF);
-#endif
+            while (!(UARTIO->SR & USART_FLAG_TXE)) {}
+            UARTIO->DR = (*ptr++ & (uint16_t)0x01FF);
         }
         break;
     default:
@@ -60,25 +26,18 @@ int _write(int file, char *ptr, int len) {
     return len;
 }
 
+/* Waits for the first byte only, like a tty would */
 int _read(int file, char *ptr, int len) {
-    int n;
     int num = 0;
     switch (file) {
     case STDIN_FILENO:
-        for (n = 0; n < len; n++) {
-#if   STDIN_USART == 1
-            while ((USART1->SR & USART_FLAG_RXNE) == (uint16_t)RESET) {}
-            char c = (char)(USART1->DR & (uint16_t)0x01FF);
-#elif STDIN_USART == 2
-            while ((USART2->SR & USART_FLAG_RXNE) == (uint16_t) RESET) {}
-            char c = (char) (USART2->DR & (uint16_t) 0x01FF);
-#elif STDIN_USART == 3
-            while ((USART3->SR & USART_FLAG_RXNE) == (uint16_t)RESET) {}
-            char c = (char)(USART3->DR & (uint16_t)0x01FF);
-#endif
-            *ptr++ = c;
+        if (!len)
+            break;
+        do {
+            while (!(UARTIO->SR & USART_FLAG_RXNE)) {}
+            *ptr++ = (char)(UARTIO->DR & (uint16_t)0x01FF);
             num++;
-        }
+        } while ((num < len) && (UARTIO->SR & USART_FLAG_RXNE));
         break;
     default:
         errno = EBADF;
@@ -63,6 +63,9 @@
 #include <avr/interrupt.h>
 #define ANTARES_DISABLE_IRQS() cli()
 #define ANTARES_ENABLE_IRQS() sei()
+/* For code that may run with interrupts off already, e.g. in an ISR */
+#define ANTARES_IRQ_SAVE(flags) do { flags = SREG; cli(); } while (0)
+#define ANTARES_IRQ_RESTORE(flags) SREG = flags
 
 #define get_system_clock()    F_CPU
 #define set_system_clock(clk) ;
@@ -64,6 +64,9 @@
 
 #define ANTARES_DISABLE_IRQS() __disable_interrupt();     
 #define ANTARES_ENABLE_IRQS() __enable_interrupt();
+/* For code that may run with interrupts off already, e.g. in an ISR */
+#define ANTARES_IRQ_SAVE(flags) do { flags = __get_interrupt_state(); __disable_interrupt(); } while (0)
+#define ANTARES_IRQ_RESTORE(flags) __set_interrupt_state(flags)
 
 #ifdef CONFIG_F_DYNAMIC
 extern uint32_t msp430_core_clock;
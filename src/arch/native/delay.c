@@ -0,0 +1,7 @@
+#include <unistd.h>
+#include <arch/delay.h>
+
+void __attribute__((weak)) delay_us(unsigned long us)
+{
+	usleep(us);
+}
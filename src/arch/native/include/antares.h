@@ -48,6 +48,8 @@ void antares_app_register(struct antares_app *app);
 
 #define ANTARES_DISABLE_IRQS() 
 #define ANTARES_ENABLE_IRQS() 
+#define ANTARES_IRQ_SAVE(flags) (void) (flags = 0)
+#define ANTARES_IRQ_RESTORE(flags) (void) (flags)
 
 #define get_system_clock()    0
 #define set_system_clock(clk) 
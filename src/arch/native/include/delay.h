@@ -0,0 +1,13 @@
+#ifndef ARCH_DELAY_H
+#define ARCH_DELAY_H
+
+/*
+ * These just sleep. delay_us() is weak, so a simulator can take it
+ * over and run its virtual clock instead.
+ */
+void delay_us(unsigned long us);
+
+#define delay_s(s)  delay_us((s) * 1000000UL)
+#define delay_ms(m) delay_us((m) * 1000UL)
+
+#endif
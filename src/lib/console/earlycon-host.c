@@ -22,6 +22,22 @@ static int stdio_getchar()
 	return c;
 }
 
+static int stdio_write(const char *buf, int len)
+{
+	fwrite(buf, 1, len, stdout);
+	fflush(stdout);
+	return len;
+}
+
+static int stdio_read(char *buf, int len)
+{
+	int c, n = 0;
+	buf[n++] = stdio_getchar();
+	while ((n < len) && ((c = getchar()) != EOF))
+		buf[n++] = c;
+	return n;
+}
+
 static void stdio_init() 
 {
 	fprintf(stderr, "earlycon: native init..\n");
@@ -42,4 +58,6 @@ struct early_console g_early_console = {
 	.txchar = stdio_putchar,
 	.init = stdio_init,		
 	.havechar = stdio_avail,
+	.txbuf = stdio_write,
+	.rxbuf = stdio_read,
 };
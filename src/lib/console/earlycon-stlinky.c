@@ -11,16 +11,44 @@ static void stl_putchar(char c)
 	stlinky_tx(&g_stlinky_term, &c, 1);
 }
 
-/* NOTE: 
- * We loose data here, if hosts sends us 
- * more than 1 byte at a time. Use this with care
+static int stl_write(const char *buf, int len)
+{
+	return stlinky_tx(&g_stlinky_term, buf, len);
+}
+
+#ifndef CONFIG_LIB_STLINKY_V2
+
+/* 
+ * The host hands us up to a whole buffer at a time, keep what
+ * the caller didn't take
  */
+static char rx[CONFIG_LIB_STLINKY_BSIZE];
+static unsigned char rx_pos, rx_len;
 
-static int stl_getchar()
+static int stl_read(char *buf, int len)
 {
-	char buf;
-	stlinky_rx(&g_stlinky_term, &buf, 1);
-	return (int) buf;
+	if (rx_pos == rx_len) {
+		rx_len = stlinky_rx(&g_stlinky_term, rx, sizeof(rx));
+		rx_pos = 0;
+	}
+	if (len > rx_len - rx_pos)
+		len = rx_len - rx_pos;
+	memcpy(buf, &rx[rx_pos], len);
+	rx_pos += len;
+	return len;
+}
+
+static int stl_avail()
+{
+	return (rx_len - rx_pos) + stlinky_avail(&g_stlinky_term);
+}
+
+#else
+
+/* The ring keeps whatever we don't take */
+static int stl_read(char *buf, int len)
+{
+	return stlinky_rx(&g_stlinky_term, buf, len);
 }
 
 static int stl_avail()
@@ -28,6 +56,15 @@ static int stl_avail()
 	return stlinky_avail(&g_stlinky_term);
 }
 
+#endif
+
+static int stl_getchar()
+{
+	char c;
+	stl_read(&c, 1);
+	return (unsigned char) c;
+}
+
 static void stl_init()
 {
 #ifdef CONFIG_LIB_EARLYCON_ANNOUNCE
@@ -39,5 +76,7 @@ struct early_console g_early_console = {
 	.havechar = stl_avail,
 	.rxchar = stl_getchar,
 	.txchar = stl_putchar,
-	.init = stl_init		
+	.init = stl_init,
+	.txbuf = stl_write,
+	.rxbuf = stl_read,
 };
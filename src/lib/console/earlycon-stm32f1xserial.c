@@ -1,97 +1,318 @@
+#include <stdint.h>
+#include <string.h>
+#include <arch/antares.h>
+#include <generic/macros.h>
 #include <lib/earlycon.h>
+#include <lib/circ_buf.h>
 #include "stm32f10x.h"
 #include "stm32f10x_rcc.h"
 #include "stm32f10x_gpio.h"
 #include "stm32f10x_usart.h"
 
+#define UART_NUM CONFIG_LIB_EARLYCON_STM32F1X_UART
+#define BAUD CONFIG_LIB_EARLYCON_STM32F1X_BAUD
 
-/* TODO: Move to menuconfig */
+/* Pins and DMA1 channels, see the reference manual */
+#if UART_NUM == 1
+#define UART           USART1
+#define UART_IRQn      USART1_IRQn
+#define UART_IRQ       USART1_IRQHandler
+#define UART_GPIO      GPIOA
+#define UART_TX_PIN    GPIO_Pin_9
+#define UART_RX_PIN    GPIO_Pin_10
+#define UART_GPIO_CLK  RCC_APB2Periph_GPIOA
+#define DMA_TX         4
+#define DMA_RX         5
+#elif UART_NUM == 2
+#define UART           USART2
+#define UART_IRQn      USART2_IRQn
+#define UART_IRQ       USART2_IRQHandler
+#define UART_GPIO      GPIOA
+#define UART_TX_PIN    GPIO_Pin_2
+#define UART_RX_PIN    GPIO_Pin_3
+#define UART_GPIO_CLK  RCC_APB2Periph_GPIOA
+#define DMA_TX         7
+#define DMA_RX         6
+#elif UART_NUM == 3
+#define UART           USART3
+#define UART_IRQn      USART3_IRQn
+#define UART_IRQ       USART3_IRQHandler
+#define UART_GPIO      GPIOB
+#define UART_TX_PIN    GPIO_Pin_10
+#define UART_RX_PIN    GPIO_Pin_11
+#define UART_GPIO_CLK  RCC_APB2Periph_GPIOB
+#define DMA_TX         2
+#define DMA_RX         3
+#else
+#error "Only USART1..3 are supported"
+#endif
 
-#define CONFIG_LIB_EARLYCON_STM32F1X_UART 1
+static void stm32f1x_uart_setup() {
+	GPIO_InitTypeDef    GPIO_InitStruct;
+	USART_InitTypeDef    USART_InitStruct;
+	USART_ClockInitTypeDef USART_ClockInitStructure;
 
-#if CONFIG_LIB_EARLYCON_STM32F1X_UART == 1
-#define USART_PERIPH RCC_APB2Periph_USART1
+	RCC_APB2PeriphClockCmd(UART_GPIO_CLK | RCC_APB2Periph_AFIO, ENABLE);
+#if UART_NUM == 1
+	RCC_APB2PeriphClockCmd(RCC_APB2Periph_USART1, ENABLE);
+#else
+	RCC_APB1PeriphClockCmd(PPCAT(RCC_APB1Periph_USART, UART_NUM), ENABLE);
 #endif
 
-#if CONFIG_LIB_EARLYCON_STM32F1X_UART == 2
-#define USART_PERIPH RCC_APB1Periph_USART2
-#endif
+	GPIO_InitStruct.GPIO_Pin = UART_TX_PIN;
+	GPIO_InitStruct.GPIO_Speed = GPIO_Speed_50MHz;
+	GPIO_InitStruct.GPIO_Mode = GPIO_Mode_AF_PP;
+	GPIO_Init(UART_GPIO, &GPIO_InitStruct);
 
-#if CONFIG_LIB_EARLYCON_STM32F1X_UART == 3
-#define USART_PERIPH RCC_APB1Periph_USART3
-#endif
+	GPIO_InitStruct.GPIO_Pin = UART_RX_PIN;
+	GPIO_InitStruct.GPIO_Mode  = GPIO_Mode_IN_FLOATING;
+	GPIO_Init(UART_GPIO, &GPIO_InitStruct);
+
+        USART_ClockStructInit(&USART_ClockInitStructure);
+        USART_ClockInit(UART, &USART_ClockInitStructure);
+
+	USART_InitStruct.USART_BaudRate = BAUD;
+	USART_InitStruct.USART_WordLength = USART_WordLength_8b;
+	USART_InitStruct.USART_StopBits = USART_StopBits_1;
+	USART_InitStruct.USART_Parity = USART_Parity_No ;
+	USART_InitStruct.USART_HardwareFlowControl = USART_HardwareFlowControl_None;
+	USART_InitStruct.USART_Mode = USART_Mode_Rx | USART_Mode_Tx;
+	USART_Init(UART, &USART_InitStruct);
+}
+
+#ifndef CONFIG_LIB_EARLYCON_STM32F1X_DMA
 
-#if CONFIG_LIB_EARLYCON_STM32F1X_UART == 4
-#define USART_PERIPH RCC_APB1Periph_UART4
+static void stm32f1x_uart_init() {
+	stm32f1x_uart_setup();
+	USART_Cmd(UART, ENABLE);
+#ifdef CONFIG_LIB_EARLYCON_RX_RING
+	USART_ITConfig(UART, USART_IT_RXNE, ENABLE);
+	NVIC_EnableIRQ(UART_IRQn);
 #endif
+}
 
-#if CONFIG_LIB_EARLYCON_STM32F1X_UART == 5
-#define USART_PERIPH RCC_APB1Periph_UART5
+#ifdef CONFIG_LIB_EARLYCON_RX_RING
+void UART_IRQ(void)
+{
+	char c;
+	while (UART->SR & USART_SR_RXNE) {
+		c = UART->DR;
+		early_rx_push(&c, 1);
+	}
+}
 #endif
 
 
+static void stm32f1x_uart_putchar(char c)
+{
+	while(!(UART->SR & USART_SR_TC));
+	UART->DR = c;
+}
 
-/* 
- * TODO: Fill in all parameters from menuconfig. 
- * webconn, this is the task for you!
- *
- */
+/* Back to back: only wait until the data register is free */
+static int stm32f1x_uart_write(const char *buf, int len)
+{
+	int i;
+	for (i = 0; i < len; i++) {
+		while (!(UART->SR & USART_SR_TXE));
+		UART->DR = buf[i];
+	}
+	return len;
+}
 
+#ifndef CONFIG_LIB_EARLYCON_RX_RING
 
+static int stm32f1x_uart_getchar() {
+	while (!(UART->SR & USART_SR_RXNE));
+	return (int) UART->DR;
+}
 
-void stm32f1x_uart_init() {
-	GPIO_InitTypeDef    GPIO_InitStruct;
-	USART_InitTypeDef    USART_InitStruct;
-	USART_ClockInitTypeDef USART_ClockInitStructure;
+static int stm32f1x_uart_read(char *buf, int len)
+{
+	int n = 0;
+	buf[n++] = stm32f1x_uart_getchar();
+	while ((n < len) && (UART->SR & USART_SR_RXNE))
+		buf[n++] = UART->DR;
+	return n;
+}
 
-	RCC_APB2PeriphClockCmd((RCC_APB2Periph_USART1 | RCC_APB2Periph_GPIOA |  RCC_APB2Periph_AFIO), ENABLE);
-	
-	GPIO_InitStruct.GPIO_Pin = GPIO_Pin_9; 
-	GPIO_InitStruct.GPIO_Speed = GPIO_Speed_50MHz; 
-	GPIO_InitStruct.GPIO_Mode = GPIO_Mode_AF_PP; 
-	GPIO_Init(GPIOA, &GPIO_InitStruct); 
 
+static int stm32f1x_uart_avail() {
+	return (UART->SR & USART_SR_RXNE);
+}
 
-	GPIO_InitStruct.GPIO_Pin = GPIO_Pin_10;
-	GPIO_InitStruct.GPIO_Mode  = GPIO_Mode_IN_FLOATING; 
-	GPIO_Init(GPIOA, &GPIO_InitStruct); 
-	
-	
-        USART_ClockStructInit(&USART_ClockInitStructure);
-        USART_ClockInit(USART1, &USART_ClockInitStructure);
+#endif
 
-	USART_InitStruct.USART_BaudRate = 115200; 
-	USART_InitStruct.USART_WordLength = USART_WordLength_8b; 
-	USART_InitStruct.USART_StopBits = USART_StopBits_1;
-	USART_InitStruct.USART_Parity = USART_Parity_No ;
-	USART_InitStruct.USART_HardwareFlowControl = USART_HardwareFlowControl_None; 
-	USART_InitStruct.USART_Mode = USART_Mode_Rx | USART_Mode_Tx;
-	USART_Init(USART1, &USART_InitStruct);
+#else /* CONFIG_LIB_EARLYCON_STM32F1X_DMA */
+
+/*
+ * Writes go into a ring and return right away, DMA sends the ring
+ * out a contiguous piece at a time and the transfer complete
+ * interrupt starts the next one. RX DMA runs circular into a small
+ * buffer. Whenever the line goes idle, or the buffer is half way
+ * through, the interrupts hand the new bytes over to the earlycon
+ * RX ring.
+ */
+
+#define TX_SIZE CONFIG_LIB_EARLYCON_STM32F1X_TX_SIZE
+#define RX_DMA_SIZE CONFIG_LIB_EARLYCON_STM32F1X_RX_DMA_SIZE
+
+#if TX_SIZE & (TX_SIZE - 1)
+#error "CONFIG_LIB_EARLYCON_STM32F1X_TX_SIZE must be a power of 2"
+#endif
+
+#define TX_CH      PPCAT(DMA1_Channel, DMA_TX)
+#define TX_CH_IRQn PPCAT3(DMA1_Channel, DMA_TX, _IRQn)
+#define TX_CH_IRQ  PPCAT3(DMA1_Channel, DMA_TX, _IRQHandler)
+#define RX_CH      PPCAT(DMA1_Channel, DMA_RX)
+#define RX_CH_IRQn PPCAT3(DMA1_Channel, DMA_RX, _IRQn)
+#define RX_CH_IRQ  PPCAT3(DMA1_Channel, DMA_RX, _IRQHandler)
+/* All flags of a channel in DMA1->IFCR, its transfer complete in ISR */
+#define CH_FLAGS(ch) (0xf << (4 * ((ch) - 1)))
+#define CH_TC(ch)    (0x2 << (4 * ((ch) - 1)))
+
+static char txq[TX_SIZE];
+static volatile unsigned int tx_head;     /* Writers */
+static volatile unsigned int tx_tail;     /* DMA complete interrupt */
+static volatile unsigned int tx_len;      /* In flight, 0 if idle */
 
-	USART_Cmd(USART1, ENABLE); 
+static char rx_dma[RX_DMA_SIZE];
+static unsigned int rx_pos;
+
+/* Called with interrupts off or from the DMA interrupt */
+static void tx_kick()
+{
+	unsigned int n;
+	if (tx_len)
+		return;
+	n = CIRC_CNT_TO_END(tx_head, tx_tail, TX_SIZE);
+	if (!n)
+		return;
+	tx_len = n;
+	TX_CH->CCR &= ~DMA_CCR1_EN;
+	TX_CH->CMAR = (uint32_t) &txq[tx_tail];
+	TX_CH->CNDTR = n;
+	TX_CH->CCR |= DMA_CCR1_EN;
+}
+
+/* Also called by hand from stm32f1x_uart_write(), hence the check */
+void TX_CH_IRQ(void)
+{
+	if (!(DMA1->ISR & CH_TC(DMA_TX)))
+		return;
+	DMA1->IFCR = CH_FLAGS(DMA_TX);
+	TX_CH->CCR &= ~DMA_CCR1_EN;
+	tx_tail = CIRC_NEXT(tx_tail, tx_len, TX_SIZE);
+	tx_len = 0;
+	tx_kick();
 }
 
+/*
+ * Interrupts off while copying, so that ISRs can printk too. When the
+ * ring is full it returns what fit, and the DMA interrupt makes room.
+ * Unless that can't get in, with interrupts masked or from a handler:
+ * then it waits for the transfer to complete and does the interrupt's
+ * job by hand, rather than spin forever on a ring that never drains.
+ */
+static int stm32f1x_uart_write(const char *buf, int len)
+{
+	uint32_t primask = __get_PRIMASK();
+	int blocked = primask || (SCB->ICSR & SCB_ICSR_VECTACTIVE_Msk);
+	unsigned int head;
+	int n, done = 0;
+
+	__disable_irq();
+	head = tx_head;
+	while (len) {
+		n = CIRC_SPACE_TO_END(head, tx_tail, TX_SIZE);
+		if (!n) {
+			if (!blocked)
+				break;
+			tx_head = head;
+			tx_kick();
+			while (!(DMA1->ISR & CH_TC(DMA_TX)));
+			TX_CH_IRQ();
+			continue;
+		}
+		if (n > len)
+			n = len;
+		memcpy(&txq[head], buf, n);
+		head = CIRC_NEXT(head, n, TX_SIZE);
+		buf += n;
+		len -= n;
+		done += n;
+	}
+	tx_head = head;
+	tx_kick();
+	__set_PRIMASK(primask);
+	return done;
+}
 
+/* Only loops with the DMA interrupt free to make room */
 static void stm32f1x_uart_putchar(char c)
 {
-	while(!(USART1->SR & USART_SR_TC)); 
-	USART1->DR = c; 
+	while (!stm32f1x_uart_write(&c, 1));
 }
 
-static int stm32f1x_uart_getchar() {
-	while (!(USART1->SR & USART_SR_RXNE));
-	return (int) USART1->DR;
+static void rx_drain()
+{
+	unsigned int pos = RX_DMA_SIZE - RX_CH->CNDTR;
+	if (pos == rx_pos)
+		return;
+	if (pos < rx_pos) {
+		early_rx_push(&rx_dma[rx_pos], RX_DMA_SIZE - rx_pos);
+		rx_pos = 0;
+	}
+	early_rx_push(&rx_dma[rx_pos], pos - rx_pos);
+	rx_pos = (pos == RX_DMA_SIZE) ? 0 : pos;
 }
 
+void RX_CH_IRQ(void)
+{
+	DMA1->IFCR = CH_FLAGS(DMA_RX);
+	rx_drain();
+}
 
-static int stm32f1x_uart_avail() {
-	return (USART1->SR & USART_SR_RXNE);
+void UART_IRQ(void)
+{
+	if (UART->SR & USART_SR_IDLE) {
+		(void) UART->DR; /* SR then DR clears IDLE */
+		rx_drain();
+	}
 }
 
+static void stm32f1x_uart_init() {
+	stm32f1x_uart_setup();
+	RCC_AHBPeriphClockCmd(RCC_AHBPeriph_DMA1, ENABLE);
+
+	TX_CH->CPAR = (uint32_t) &UART->DR;
+	TX_CH->CCR = DMA_CCR1_DIR | DMA_CCR1_MINC | DMA_CCR1_TCIE;
+
+	RX_CH->CPAR = (uint32_t) &UART->DR;
+	RX_CH->CMAR = (uint32_t) rx_dma;
+	RX_CH->CNDTR = RX_DMA_SIZE;
+	RX_CH->CCR = DMA_CCR1_MINC | DMA_CCR1_CIRC |
+		DMA_CCR1_HTIE | DMA_CCR1_TCIE | DMA_CCR1_EN;
+
+	UART->CR3 |= USART_CR3_DMAT | USART_CR3_DMAR;
+	UART->CR1 |= USART_CR1_IDLEIE;
+	NVIC_EnableIRQ(TX_CH_IRQn);
+	NVIC_EnableIRQ(RX_CH_IRQn);
+	NVIC_EnableIRQ(UART_IRQn);
+	USART_Cmd(UART, ENABLE);
+}
+
+#endif
+
 
 struct early_console g_early_console = {
-	.rxchar = stm32f1x_uart_getchar,
 	.txchar = stm32f1x_uart_putchar,
-	.init = stm32f1x_uart_init,		
+	.init = stm32f1x_uart_init,
+	.txbuf = stm32f1x_uart_write,
+#ifndef CONFIG_LIB_EARLYCON_RX_RING
+	/* Otherwise the interrupt takes care of it */
+	.rxchar = stm32f1x_uart_getchar,
 	.havechar = stm32f1x_uart_avail,
+	.rxbuf = stm32f1x_uart_read,
+#endif
 };
@@ -1,6 +1,9 @@
 #include <lib/earlycon.h>
 #include <lib/printk.h>
 #include <stdlib.h>
+#include <string.h>
+#include <generic/macros.h>
+#include <lib/circ_buf.h>
 
 extern struct early_console g_early_console;
 static char initialized = 0;
@@ -31,10 +34,159 @@ void early_putc(char c) {
 	g_early_console.txchar(c);
 }
 
+static void early_tx(const char *buf, int len)
+{
+	if (g_early_console.txbuf) {
+		int n;
+		while (len) {
+			n = g_early_console.txbuf(buf, len);
+			buf += n;
+			len -= n;
+		}
+		return;
+	}
+	while (len--)
+		g_early_console.txchar(*buf++);
+}
+
+/* Hands the whole buffer to the driver, not a char at a time */
+int early_write(const char *buf, int len) {
+	int ret = len;
+#ifdef CONFIG_LIB_EARLYCON_ADDCR
+	const char *nl;
+#endif
+	early_console_checkinit();
+#ifdef CONFIG_LIB_EARLYCON_ADDCR
+	while ((nl = memchr(buf, '\n', len))) {
+		early_tx(buf, nl - buf);
+		early_tx("\r\n", 2);
+		len -= nl - buf + 1;
+		buf = nl + 1;
+	}
+#endif
+	early_tx(buf, len);
+	return ret;
+}
+
+static char nonblock;
+
+void early_set_nonblock(int on) {
+	nonblock = on;
+}
+
+#ifdef CONFIG_LIB_EARLYCON_RX_RING
+
+/*
+ * Input goes through a ring. Drivers with an RX interrupt push into 
+ * it with early_rx_push() and leave rxchar/rxbuf/havechar out, the 
+ * others are polled for whatever they have before each read.
+ */
+
+#define RX_SIZE CONFIG_LIB_EARLYCON_RX_RING_SIZE
+
+#if RX_SIZE & (RX_SIZE - 1)
+#error "CONFIG_LIB_EARLYCON_RX_RING_SIZE must be a power of 2"
+#endif
+
+static char rx_ring[RX_SIZE];
+static volatile unsigned int rx_head; /* Driver / ISR */
+static volatile unsigned int rx_tail; /* Reader */
+static unsigned int rx_lost;
+
+int early_rx_push(const char *data, int len) {
+	unsigned int head = rx_head;
+	int n, done = 0;
+	while (len) {
+		n = CIRC_SPACE_TO_END(head, rx_tail, RX_SIZE);
+		if (!n) {
+			rx_lost += len;
+			break;
+		}
+		if (n > len)
+			n = len;
+		memcpy(&rx_ring[head], data, n);
+		head = CIRC_NEXT(head, n, RX_SIZE);
+		data += n;
+		len -= n;
+		done += n;
+	}
+	barrier();
+	rx_head = head;
+	return done;
+}
+
+unsigned int early_rx_lost() {
+	return rx_lost;
+}
+
+static void rx_poll() {
+	unsigned int head;
+	int n;
+	if (!g_early_console.havechar)
+		return;
+	while (g_early_console.havechar()) {
+		head = rx_head;
+		n = CIRC_SPACE_TO_END(head, rx_tail, RX_SIZE);
+		if (!n)
+			break;
+		if (g_early_console.rxbuf) {
+			n = g_early_console.rxbuf(&rx_ring[head], n);
+		} else {
+			rx_ring[head] = g_early_console.rxchar();
+			n = 1;
+		}
+		barrier();
+		rx_head = CIRC_NEXT(head, n, RX_SIZE);
+	}
+}
+
+/* Whatever there is, waits for something unless non-blocking */
+int early_read(char *buf, int len) {
+	unsigned int tail;
+	int n, done = 0;
+	early_console_checkinit();
+	for (;;) {
+		rx_poll();
+		tail = rx_tail;
+		while (done < len) {
+			n = CIRC_CNT_TO_END(rx_head, tail, RX_SIZE);
+			if (!n)
+				break;
+			if (n > len - done)
+				n = len - done;
+			memcpy(&buf[done], &rx_ring[tail], n);
+			tail = CIRC_NEXT(tail, n, RX_SIZE);
+			done += n;
+		}
+		barrier();
+		rx_tail = tail;
+		if (done || nonblock || !len)
+			return done;
+	}
+}
+
+int early_getc() {
+	char c;
+	if (early_read(&c, 1) <= 0)
+		return -1;
+	return (unsigned char) c;
+}
+
+int early_avail() {
+	early_console_checkinit();
+	rx_poll();
+	return CIRC_CNT(rx_head, rx_tail, RX_SIZE);
+}
+
+#else
+
 int early_getc() {
 	early_console_checkinit();
 	if (NULL == g_early_console.rxchar)
 		return -1;
+	if (nonblock && g_early_console.havechar &&
+	    !g_early_console.havechar())
+		return -1;
 	return g_early_console.rxchar();
 }
 
@@ -46,4 +198,24 @@ int early_avail() {
 	return g_early_console.havechar();
 }
 
+/* Waits for at least one byte unless non-blocking, takes what's there after that */
+int early_read(char *buf, int len) {
+	int n = 0;
+	early_console_checkinit();
+	if (!len)
+		return 0;
+	if (nonblock && g_early_console.havechar &&
+	    !g_early_console.havechar())
+		return 0;
+	if (g_early_console.rxbuf)
+		return g_early_console.rxbuf(buf, len);
+	if (NULL == g_early_console.rxchar)
+		return -1;
+	do {
+		buf[n++] = g_early_console.rxchar();
+	} while ((n < len) && g_early_console.havechar &&
+		 g_early_console.havechar());
+	return n;
+}
 
+#endif
@@ -1,34 +1,30 @@
+#define _GNU_SOURCE /* fopencookie() on glibc */
 #include <stdint.h>
 #include <lib/earlycon.h>
-#include <lib/stlinky.h>
 
 #include <stdio.h>
 #include <errno.h>
 #include <string.h>
 #include <arch/antares.h>
-#include "stm32f10x_gpio.h"
-#include "stm32f10x_rcc.h"
-#include "stm32f10x_usart.h"
 
 
 FILE* g_early_stdin;
 FILE* g_early_stdout;
 
+/* Short reads: whatever has arrived, at least a byte unless non-blocking */
 static ssize_t cookie_read_function(void *_cookie, char *_buf, size_t n)
 {
-	size_t i = 0;
-	while (i < n) { 
-		*_buf++ = (char) early_getc();
-	} ;
-	return n;
+	int ret = early_read(_buf, n);
+	if (ret == 0 && n) {
+		errno = EAGAIN;
+		return -1;
+	}
+	return ret;
 }
 
 static ssize_t cookie_write_function(void *_cookie, const char *_buf, size_t n)
 {
-	size_t i = 0;
-	while (i < n) 
-		early_putc(_buf[i++]);
-	return n;
+	return early_write(_buf, n);
 }
 
 
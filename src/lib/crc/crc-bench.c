@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <arch/antares.h>
+#include <lib/crc.h>
+
+/*
+ * Every software implementation against the bitwise one on odd
+ * lengths and alignments, then MB/s for each over a buffer that
+ * stays in cache.
+ */
+
+#define BUFSIZE 65536
+#define MIN_TIME 0.2
+
+static uint8_t buf[BUFSIZE + 8];
+static int errors;
+
+static double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Each width gets a wrapper, so they can all go in one table */
+struct impl {
+	const char *name;
+	uint32_t (*fn)(uint32_t crc, const void *data, int len);
+	uint32_t check;          /* Of "123456789" */
+	uint32_t init;
+};
+
+#define WRAP(w, name) \
+	static uint32_t w_##name(uint32_t crc, const void *data, int len) \
+	{ return name((uint ## w ## _t) crc, data, len); }
+
+WRAP(8, crc8_bitwise)
+WRAP(8, crc8_nibble)
+WRAP(8, crc8_table)
+WRAP(16, crc16_ccitt_bitwise)
+WRAP(16, crc16_ccitt_nibble)
+WRAP(16, crc16_ccitt_table)
+WRAP(16, crc16_ccitt_slice)
+WRAP(32, crc32_bitwise)
+WRAP(32, crc32_nibble)
+WRAP(32, crc32_table)
+WRAP(32, crc32_slice)
+
+static const struct impl impls[] = {
+	{ "crc8 bitwise",         w_crc8_bitwise,        0xf4, 0 },
+	{ "crc8 nibble",          w_crc8_nibble,         0xf4, 0 },
+	{ "crc8 table",           w_crc8_table,          0xf4, 0 },
+	{ "crc16-ccitt bitwise",  w_crc16_ccitt_bitwise, 0x29b1, 0xffff },
+	{ "crc16-ccitt nibble",   w_crc16_ccitt_nibble,  0x29b1, 0xffff },
+	{ "crc16-ccitt table",    w_crc16_ccitt_table,   0x29b1, 0xffff },
+	{ "crc16-ccitt slice",    w_crc16_ccitt_slice,   0x29b1, 0xffff },
+	{ "crc32 bitwise",        w_crc32_bitwise,       0xcbf43926, 0 },
+	{ "crc32 nibble",         w_crc32_nibble,        0xcbf43926, 0 },
+	{ "crc32 table",          w_crc32_table,         0xcbf43926, 0 },
+	{ "crc32 slice",          w_crc32_slice,         0xcbf43926, 0 },
+};
+
+#define NIMPLS (sizeof(impls) / sizeof(impls[0]))
+
+/* The bitwise one of the same width comes first in the table */
+static const struct impl *reference(const struct impl *i)
+{
+	while (i > impls && i[-1].check == i->check)
+		i--;
+	return i;
+}
+
+static void verify(const struct impl *i)
+{
+	const struct impl *ref = reference(i);
+	int off, len, split;
+	uint32_t a, b;
+
+	if (i->fn(i->init, "123456789", 9) != i->check) {
+		printf("%s: wrong check value\n", i->name);
+		errors++;
+	}
+	for (off = 0; off < 8; off++)
+		for (len = 0; len < 100; len += 3) {
+			split = len / 3;
+			a = ref->fn(i->init, &buf[off], len);
+			b = i->fn(i->fn(i->init, &buf[off], split),
+				  &buf[off + split], len - split);
+			if (a != b) {
+				printf("%s: wrong at offset %d, length %d\n",
+				       i->name, off, len);
+				errors++;
+				return;
+			}
+		}
+}
+
+static double speed(const struct impl *i)
+{
+	volatile uint32_t sink = 0;
+	double start = now(), t;
+	unsigned long n = 0;
+	do {
+		sink ^= i->fn(i->init, buf, BUFSIZE);
+		n++;
+		t = now() - start;
+	} while (t < MIN_TIME);
+	return n * (double) BUFSIZE / t / 1e6;
+}
+
+ANTARES_APP(crc_bench)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(buf); i++)
+		buf[i] = rand();
+
+	printf("crc-bench: slice-by-%d\n", CONFIG_LIB_CRC_SLICE_N);
+	for (i = 0; i < NIMPLS; i++) {
+		verify(&impls[i]);
+		printf("%-22s %8.1f MB/s\n", impls[i].name, speed(&impls[i]));
+	}
+	printf("crc-bench: %s\n", errors ? "FAILED" : "all agree");
+	exit(errors ? 1 : 0);
+}
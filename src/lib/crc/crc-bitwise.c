@@ -0,0 +1,51 @@
+/*
+ * A bit at a time, no tables at all. These define what the others
+ * compute: CRC-8 is polynomial 0x07, CRC16-CCITT 0x1021, both most
+ * significant bit first with no final xor. CRC-32 is the reflected
+ * 0xedb88320 one of zlib and ethernet.
+ */
+
+#include <stdint.h>
+#include <lib/crc.h>
+
+uint8_t crc8_bitwise(uint8_t crc, const void *data, int len)
+{
+	const uint8_t *p = data;
+	int i;
+	while (len--) {
+		crc ^= *p++;
+		for (i = 0; i < 8; i++)
+			crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : (crc << 1);
+	}
+	return crc;
+}
+
+uint16_t crc16_ccitt_byte_bitwise(uint16_t crc, uint8_t b)
+{
+	int i;
+	crc ^= (uint16_t) b << 8;
+	for (i = 0; i < 8; i++)
+		crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+	return crc;
+}
+
+uint16_t crc16_ccitt_bitwise(uint16_t crc, const void *data, int len)
+{
+	const uint8_t *p = data;
+	while (len--)
+		crc = crc16_ccitt_byte_bitwise(crc, *p++);
+	return crc;
+}
+
+uint32_t crc32_bitwise(uint32_t crc, const void *data, int len)
+{
+	const uint8_t *p = data;
+	int i;
+	crc = ~crc;
+	while (len--) {
+		crc ^= *p++;
+		for (i = 0; i < 8; i++)
+			crc = (crc & 1) ? (crc >> 1) ^ 0xedb88320 : (crc >> 1);
+	}
+	return ~crc;
+}
@@ -0,0 +1,62 @@
+/*
+ * A nibble at a time, 16 entry tables. Half the speed of the byte
+ * tables for a fraction of the flash.
+ */
+
+#include <stdint.h>
+#include <lib/crc.h>
+
+static const uint8_t crc8_nib[16] = {
+	0x00, 0x07, 0x0e, 0x09, 0x1c, 0x1b, 0x12, 0x15,
+	0x38, 0x3f, 0x36, 0x31, 0x24, 0x23, 0x2a, 0x2d,
+};
+
+static const uint16_t crc16_ccitt_nib[16] = {
+	0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
+	0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef,
+};
+
+static const uint32_t crc32_nib[16] = {
+	0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac,
+	0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+	0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+	0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c,
+};
+
+uint8_t crc8_nibble(uint8_t crc, const void *data, int len)
+{
+	const uint8_t *p = data;
+	while (len--) {
+		crc ^= *p++;
+		crc = (uint8_t) (crc << 4) ^ crc8_nib[crc >> 4];
+		crc = (uint8_t) (crc << 4) ^ crc8_nib[crc >> 4];
+	}
+	return crc;
+}
+
+uint16_t crc16_ccitt_byte_nibble(uint16_t crc, uint8_t b)
+{
+	crc = (uint16_t) (crc << 4) ^ crc16_ccitt_nib[(crc >> 12) ^ (b >> 4)];
+	crc = (uint16_t) (crc << 4) ^ crc16_ccitt_nib[(crc >> 12) ^ (b & 0x0f)];
+	return crc;
+}
+
+uint16_t crc16_ccitt_nibble(uint16_t crc, const void *data, int len)
+{
+	const uint8_t *p = data;
+	while (len--)
+		crc = crc16_ccitt_byte_nibble(crc, *p++);
+	return crc;
+}
+
+uint32_t crc32_nibble(uint32_t crc, const void *data, int len)
+{
+	const uint8_t *p = data;
+	crc = ~crc;
+	while (len--) {
+		crc ^= *p++;
+		crc = (crc >> 4) ^ crc32_nib[crc & 0x0f];
+		crc = (crc >> 4) ^ crc32_nib[crc & 0x0f];
+	}
+	return ~crc;
+}
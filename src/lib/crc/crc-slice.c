@@ -0,0 +1,98 @@
+/*
+ * Slice-by-N: N bytes per step, through N tables looked up
+ * independently of each other. The first table is the flash one
+ * from crc-table.c, the rest are made in RAM on first use.
+ * CRC-8 has nothing to gain and uses the byte table.
+ */
+
+#include <stdint.h>
+#include <lib/crc.h>
+
+#define N CONFIG_LIB_CRC_SLICE_N
+
+#if N != 4 && N != 8
+#error "CONFIG_LIB_CRC_SLICE_N must be 4 or 8"
+#endif
+
+static uint16_t crc16_slices[N - 1][256];
+static uint32_t crc32_slices[N - 1][256];
+
+/* t[k][b]: what byte b at the top turns into after k more zero bytes */
+static const uint16_t *t16[N];
+static const uint32_t *t32[N];
+
+static void crc16_init()
+{
+	uint16_t c;
+	int k, i;
+	for (i = 0; i < 256; i++) {
+		c = crc16_ccitt_tab[i];
+		for (k = 0; k < N - 1; k++) {
+			c = (c << 8) ^ crc16_ccitt_tab[c >> 8];
+			crc16_slices[k][i] = c;
+		}
+	}
+	for (k = 1; k < N; k++)
+		t16[k] = crc16_slices[k - 1];
+	t16[0] = crc16_ccitt_tab;
+}
+
+static void crc32_init()
+{
+	uint32_t c;
+	int k, i;
+	for (i = 0; i < 256; i++) {
+		c = crc32_tab[i];
+		for (k = 0; k < N - 1; k++) {
+			c = (c >> 8) ^ crc32_tab[c & 0xff];
+			crc32_slices[k][i] = c;
+		}
+	}
+	for (k = 1; k < N; k++)
+		t32[k] = crc32_slices[k - 1];
+	t32[0] = crc32_tab;
+}
+
+uint16_t crc16_ccitt_slice(uint16_t crc, const void *data, int len)
+{
+	const uint8_t *p = data;
+	uint16_t c;
+	int k;
+
+	if (!t16[0])
+		crc16_init();
+	while (len >= N) {
+		c = crc ^ ((p[0] << 8) | p[1]);
+		crc = t16[N - 1][c >> 8] ^ t16[N - 2][c & 0xff];
+		for (k = 2; k < N; k++)
+			crc ^= t16[N - 1 - k][p[k]];
+		p += N;
+		len -= N;
+	}
+	while (len--)
+		crc = (crc << 8) ^ crc16_ccitt_tab[(crc >> 8) ^ *p++];
+	return crc;
+}
+
+uint32_t crc32_slice(uint32_t crc, const void *data, int len)
+{
+	const uint8_t *p = data;
+	uint32_t c;
+	int k;
+
+	if (!t32[0])
+		crc32_init();
+	crc = ~crc;
+	while (len >= N) {
+		c = crc ^ (p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24));
+		crc = t32[N - 1][c & 0xff] ^ t32[N - 2][(c >> 8) & 0xff] ^
+			t32[N - 3][(c >> 16) & 0xff] ^ t32[N - 4][c >> 24];
+		for (k = 4; k < N; k++)
+			crc ^= t32[N - 1 - k][p[k]];
+		p += N;
+		len -= N;
+	}
+	while (len--)
+		crc = (crc >> 8) ^ crc32_tab[(crc ^ *p++) & 0xff];
+	return ~crc;
+}
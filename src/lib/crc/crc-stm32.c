@@ -0,0 +1,61 @@
+#include <stdint.h>
+#include <arch/antares.h>
+#include <lib/crc.h>
+
+#if defined(CONFIG_STM32F1X)
+#include "stm32f10x.h"
+#define CRC_CLOCK_ON() (RCC->AHBENR |= RCC_AHBENR_CRCEN)
+#elif defined(CONFIG_STM32F4X)
+#include "stm32f4xx.h"
+#define CRC_CLOCK_ON() (RCC->AHB1ENR |= RCC_AHB1ENR_CRCEN)
+#endif
+
+/*
+ * The CRC unit does the same polynomial, but a word at a time, most
+ * significant bit first and not reflected. Bit reversing the words
+ * on the way in and the result on the way out turns it into the
+ * zlib one. Its register can only be reset to all ones, so to carry
+ * on from an earlier crc the first word fed is one that takes the
+ * register from there to where we want it. Misaligned heads and the
+ * tail are done in software.
+ */
+
+#define POLY 0x04c11db7
+
+/* Undo 32 shifts of the register, i.e. divide by x^32 */
+static uint32_t unshift(uint32_t v)
+{
+	int i;
+	for (i = 0; i < 32; i++)
+		v = (v & 1) ? ((v ^ POLY) >> 1) | 0x80000000 : (v >> 1);
+	return v;
+}
+
+uint32_t crc32_stm32(uint32_t crc, const void *data, int len)
+{
+	static char clock_on;
+	const uint8_t *p = data;
+	uint32_t r;
+	int head = (-(uintptr_t) p) & 3;
+
+	if (len < 4 + head)
+		return crc32_soft(crc, data, len);
+
+	crc = crc32_soft(crc, p, head);
+	p += head;
+	len -= head;
+
+	if (!clock_on) {
+		CRC_CLOCK_ON();
+		clock_on = 1;
+	}
+	CRC->CR = CRC_CR_RESET;
+	r = __RBIT(~crc);
+	if (r != 0xffffffff)
+		CRC->DR = 0xffffffff ^ unshift(r);
+	for (; len >= 4; len -= 4, p += 4)
+		CRC->DR = __RBIT(*(const uint32_t *) p);
+	crc = ~__RBIT(CRC->DR);
+
+	return crc32_soft(crc, p, len);
+}
@@ -0,0 +1,51 @@
+#include <stdint.h>
+#include <generic/macros.h>
+#include <lib/crc.h>
+
+/* The selected implementation */
+#if defined(CONFIG_LIB_CRC_BITWISE)
+#define IMPL     bitwise
+#define IMPL_8   bitwise
+#define IMPL_B   bitwise
+#elif defined(CONFIG_LIB_CRC_NIBBLE)
+#define IMPL     nibble
+#define IMPL_8   nibble
+#define IMPL_B   nibble
+#elif defined(CONFIG_LIB_CRC_TABLE)
+#define IMPL     table
+#define IMPL_8   table
+#define IMPL_B   table
+#elif defined(CONFIG_LIB_CRC_SLICE)
+#define IMPL     slice
+#define IMPL_8   table
+#define IMPL_B   table
+#endif
+
+uint8_t crc8(uint8_t crc, const void *data, int len)
+{
+	return PPCAT(crc8_, IMPL_8)(crc, data, len);
+}
+
+uint16_t crc16_ccitt(uint16_t crc, const void *data, int len)
+{
+	return PPCAT(crc16_ccitt_, IMPL)(crc, data, len);
+}
+
+uint16_t crc16_ccitt_byte(uint16_t crc, uint8_t b)
+{
+	return PPCAT(crc16_ccitt_byte_, IMPL_B)(crc, b);
+}
+
+uint32_t crc32_soft(uint32_t crc, const void *data, int len)
+{
+	return PPCAT(crc32_, IMPL)(crc, data, len);
+}
+
+uint32_t crc32(uint32_t crc, const void *data, int len)
+{
+#ifdef CONFIG_LIB_CRC32_STM32
+	return crc32_stm32(crc, data, len);
+#else
+	return PPCAT(crc32_, IMPL)(crc, data, len);
+#endif
+}
@@ -1,9 +1,12 @@
+#include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <arch/antares.h>
 #include <lib/tasks.h>
 #include <lib/earlycon.h>
+#include <lib/printk.h>
 
 /* TODO: Use ARCH_HAS_STDIO instead */
 #if !defined(CONFIG_ARCH_8051) && !defined(CONFIG_ARCH_MSP430)
@@ -57,6 +60,8 @@ static FILE **p_stdout;
 #endif
 
 
+#ifndef CONFIG_LIB_PRINTK_RING
+
 static void printk_prefix()
 {
 	CHECK_STDOUT;
@@ -98,3 +103,266 @@ void printk_P(const char *fmt, /*args*/ ...)
 	va_end(ap);
 }
 #endif
+
+#else /* CONFIG_LIB_PRINTK_RING */
+
+/*
+ * printk formats a line on the stack and copies it into the ring in
+ * one go, the console gets it later from printk_flush() or the UART
+ * TX interrupt. Writers may interrupt each other (ISRs), each one
+ * reserves its space with a compare-and-swap on 'reserved' first.
+ * Since a nested writer always finishes before the one it interrupted
+ * goes on, only the outermost one moves 'head' to publish the data.
+ * Everything reserved until then is complete by that time. Being 
+ * LIFO also makes the plain ++/-- on 'nest' safe.
+ */
+
+#define RING_SIZE CONFIG_LIB_PRINTK_RING_SIZE
+#define RING_LINE CONFIG_LIB_PRINTK_RING_LINE
+
+#if RING_SIZE & (RING_SIZE - 1)
+#error "CONFIG_LIB_PRINTK_RING_SIZE must be a power of 2"
+#endif
+
+static char ring[RING_SIZE];
+/* Free running, masked on access */
+static volatile unsigned int reserved;
+static volatile unsigned int head;
+static volatile unsigned int tail;
+static volatile unsigned char nest;
+static struct printk_ring_stats stats;
+static unsigned int reported_lost;
+
+#ifdef __GCC_HAVE_SYNC_COMPARE_AND_SWAP_4
+#define ring_cas(p, o, n) __sync_bool_compare_and_swap(p, o, n)
+#define ring_add(p, v)    __sync_fetch_and_add(p, v)
+#else
+/*
+ * No CAS on this one, so keep interrupts off for a couple of
+ * instructions. Put them back as they were, this may be an ISR.
+ */
+#ifndef ANTARES_IRQ_SAVE
+#define ANTARES_IRQ_SAVE(flags) do { (void) (flags); ANTARES_DISABLE_IRQS(); } while (0)
+#define ANTARES_IRQ_RESTORE(flags) ANTARES_ENABLE_IRQS()
+#endif
+
+static int ring_cas(volatile unsigned int *p, unsigned int o, unsigned int n)
+{
+	unsigned int flags;
+	int ok;
+	ANTARES_IRQ_SAVE(flags);
+	ok = (*p == o);
+	if (ok)
+		*p = n;
+	ANTARES_IRQ_RESTORE(flags);
+	return ok;
+}
+
+static void ring_add(volatile unsigned int *p, unsigned int v)
+{
+	unsigned int flags;
+	ANTARES_IRQ_SAVE(flags);
+	*p += v;
+	ANTARES_IRQ_RESTORE(flags);
+}
+#endif
+
+static void ring_put(const char *line, unsigned int len)
+{
+	unsigned int start, end, used, n;
+
+	nest++;
+	do {
+		start = reserved;
+		used = start - tail + len;
+		if (used > RING_SIZE) {
+			/* Nested writers may count at the same time */
+			ring_add(&stats.lost, 1);
+			ring_add(&stats.lost_bytes, len);
+			goto out;
+		}
+	} while (!ring_cas(&reserved, start, start + len));
+
+	while ((n = stats.peak) < used && !ring_cas(&stats.peak, n, used));
+	n = RING_SIZE - (start & (RING_SIZE - 1));
+	if (n > len)
+		n = len;
+	memcpy(&ring[start & (RING_SIZE - 1)], line, n);
+	memcpy(ring, line + n, len - n);
+
+out:
+	/*
+	 * Anybody who reserved meanwhile is done already. Look again 
+	 * after leaving, somebody might have come in right before that
+	 */
+	for (;;) {
+		if (nest == 1) {
+			end = reserved;
+			barrier();
+			head = end;
+		}
+		if (--nest || (head == reserved))
+			break;
+		nest++;
+	}
+}
+
+static int printk_prefix_buf(char *buf, int size)
+{
+	int n = 0;
+#ifdef CONFIG_LIB_PRINTK_PREFIX
+	n += snprintf(buf, size, "%s", CONFIG_LIB_PRINTK_PREFIX_V);
+#endif
+#ifdef CONFIG_LIB_PRINTK_TIMESTAMP
+	if (n < size)
+		n += snprintf(buf + n, size - n, "[%d	] ", tmgr_get_uptime());
+#endif
+	return n;
+}
+
+#ifndef CONFIG_LIB_PRINTK_BINARY
+
+#define TEXT_HDR 0
+
+static void printk_ring_line(char *line, int n)
+{
+	if (n >= RING_LINE) {
+		ring_add(&stats.truncated, 1);
+		n = RING_LINE - 1;
+	}
+	ring_put(line, n);
+}
+
+#else
+
+/* The record length is a byte */
+#if RING_LINE + PRINTK_BIN_HDR - 2 > 255
+#error "CONFIG_LIB_PRINTK_RING_LINE is too long for binary mode"
+#endif
+
+/* [ PRINTK_REC_TEXT | len | text ] */
+#define TEXT_HDR 2
+
+static void printk_ring_line(char *line, int n)
+{
+	if (n >= RING_LINE) {
+		ring_add(&stats.truncated, 1);
+		n = RING_LINE - 1;
+	}
+	line -= TEXT_HDR;
+	line[0] = PRINTK_REC_TEXT;
+	line[1] = n;
+	ring_put(line, n + TEXT_HDR);
+}
+
+/* Linker made */
+extern const char __start_printk_fmt[];
+
+void printk_bin(const char *fmt, struct printk_bin *b)
+{
+	unsigned char *h = b->buf;
+	uint16_t id = fmt - __start_printk_fmt;
+	if (b->dropped)
+		ring_add(&stats.truncated, 1);
+#ifdef CONFIG_LIB_PRINTK_TIMESTAMP
+	unsigned int t = tmgr_get_uptime();
+	h[0] = PRINTK_REC_BIN_TS;
+	memcpy(&h[4], &t, sizeof(t));
+#else
+	h[0] = PRINTK_REC_BIN;
+#endif
+	h[1] = PRINTK_BIN_HDR - 2 + b->len;
+	memcpy(&h[2], &id, sizeof(id));
+	ring_put((char *) h, PRINTK_BIN_HDR + b->len);
+}
+
+#endif
+
+void printk_R(const char *fmt, /*args*/ ...) 
+{
+	char buf[TEXT_HDR + RING_LINE];
+	char *line = &buf[TEXT_HDR];
+	va_list ap;
+	int n = printk_prefix_buf(line, RING_LINE);
+	va_start(ap, fmt); 
+	if (n < RING_LINE)
+		n += vsnprintf(line + n, RING_LINE - n, fmt, ap);
+	va_end(ap);
+	printk_ring_line(line, n);
+}
+
+#ifdef CONFIG_ARCH_AVR
+void printk_P(const char *fmt, /*args*/ ...)
+{
+	char line[RING_LINE];
+	va_list ap;
+	int n = printk_prefix_buf(line, sizeof(line));
+	va_start(ap, fmt); 
+	if (n < sizeof(line))
+		n += vsnprintf_P(line + n, sizeof(line) - n, fmt, ap);
+	va_end(ap);
+	printk_ring_line(line, n);
+}
+#endif
+
+int printk_ring_peek(const char **data)
+{
+	unsigned int h = head;
+	unsigned int t = tail;
+	unsigned int n = RING_SIZE - (t & (RING_SIZE - 1));
+	*data = &ring[t & (RING_SIZE - 1)];
+	barrier();
+	return (h - t < n) ? h - t : n;
+}
+
+void printk_ring_consume(int n)
+{
+	barrier();
+	tail += n;
+}
+
+int printk_ring_getc()
+{
+	const char *p;
+	int c;
+	if (!printk_ring_peek(&p))
+		return -1;
+	c = (unsigned char) *p;
+	printk_ring_consume(1);
+	return c;
+}
+
+void printk_ring_stats(struct printk_ring_stats *s)
+{
+	*s = stats;
+}
+
+void printk_flush()
+{
+	const char *p;
+	int n;
+	unsigned int lost;
+	CHECK_STDOUT;
+	for (;;) {
+		while ((n = printk_ring_peek(&p))) {
+			fwrite(p, 1, n, *p_stdout);
+			printk_ring_consume(n);
+		}
+		lost = stats.lost;
+		if (lost == reported_lost)
+			break;
+		/* Goes through the ring, so it comes out right in binary mode too */
+		printk_R("printk: %u messages lost\n", lost - reported_lost);
+		reported_lost = lost;
+	}
+	fflush(*p_stdout);
+}
+
+#ifdef CONFIG_LIB_PRINTK_RING_APP
+ANTARES_APP(printk_flush_app)
+{
+	printk_flush();
+}
+#endif
+
+#endif /* CONFIG_LIB_PRINTK_RING */
@@ -0,0 +1,153 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arch/antares.h>
+#include <lib/spisd.h>
+#include <lib/spisd-cache.h>
+#include <lib/spisd-emu.h>
+
+/*
+ * What a FAT filesystem does when a file is appended to a block at
+ * a time: each data block, then a read-modify-write of the FAT
+ * sector covering its cluster, every few blocks the directory entry
+ * and the FSInfo sector. Runs the same thing straight on the card
+ * and through the cache, then checks the image holds what it should.
+ */
+
+#define NDATA      CONFIG_LIB_SPISD_CACHE_BENCH_BLOCKS
+#define IMAGE      CONFIG_LIB_SPISD_CACHE_BENCH_IMAGE
+
+#define FSINFO     1
+#define FAT        32
+#define DIR        96
+#define DATA       128
+#define NBLOCKS    ((DATA + NDATA + 1023) & ~1023)
+
+#define CLUSTER    4   /* blocks */
+#define DIR_EVERY  16
+#define INFO_EVERY 64
+
+static struct sd_card card;
+static struct sd_cache cache;
+static char *shadow;
+static int cached;
+static unsigned long reads, writes;
+
+static void die(const char *what, unsigned long block, int ret)
+{
+	fprintf(stderr, "spisd-cache-bench: %s %lu failed: %d\n", what, block, ret);
+	exit(1);
+}
+
+static void rd(unsigned long block, char *buf)
+{
+	int ret = cached ? sd_cache_read(&cache, block, buf) : sd_read(&card, block, buf);
+	reads++;
+	if (ret)
+		die("read", block, ret);
+}
+
+static void wr(unsigned long block, char *buf)
+{
+	int ret = cached ? sd_cache_write(&cache, block, buf) : sd_write(&card, block, buf);
+	writes++;
+	if (ret)
+		die("write", block, ret);
+	memcpy(&shadow[block * 512], buf, 512);
+}
+
+/* Read, change a 32 bit word, write back */
+static void rmw(unsigned long block, int word, uint32_t v)
+{
+	char buf[512];
+	rd(block, buf);
+	memcpy(&buf[word * 4], &v, 4);
+	wr(block, buf);
+}
+
+static void workload()
+{
+	char buf[512];
+	unsigned long i, cl;
+	int j;
+
+	for (i = 0; i < NDATA; i++) {
+		for (j = 0; j < 512; j++)
+			buf[j] = i * 31 + j;
+		wr(DATA + i, buf);
+		if (i % CLUSTER == CLUSTER - 1) {
+			/* Link the cluster in */
+			cl = i / CLUSTER;
+			rmw(FAT + cl / 128, cl % 128, cl + 1);
+		}
+		if (i % DIR_EVERY == DIR_EVERY - 1)
+			rmw(DIR, 7, (i + 1) * 512);
+		if (i % INFO_EVERY == INFO_EVERY - 1)
+			rmw(FSINFO, 122, NDATA - i);
+	}
+}
+
+static void verify()
+{
+	char buf[512];
+	unsigned long i;
+	for (i = 0; i < NBLOCKS; i++) {
+		if (sd_read(&card, i, buf))
+			die("verify read", i, 1);
+		if (memcmp(buf, &shadow[i * 512], 512))
+			die("verify", i, 0);
+	}
+}
+
+static void run(int use_cache)
+{
+	struct sd_emu_stats st;
+
+	unlink(IMAGE);
+	if (sd_emu_open(IMAGE, NBLOCKS))
+		exit(1);
+	sd_emu_attach(&card);
+	if (sd_init(&card))
+		die("init", 0, 1);
+
+	memset(shadow, 0, NBLOCKS * 512);
+	cached = use_cache;
+	reads = writes = 0;
+	sd_cache_init(&cache, &card);
+
+	memset(&sd_emu_stats, 0, sizeof(sd_emu_stats));
+	workload();
+	if (cached && sd_cache_flush(&cache))
+		die("flush", 0, 1);
+	st = sd_emu_stats;
+
+	printf("%s: %lu reads, %lu writes, %lu data blocks\n",
+	       cached ? "cached" : "direct", reads, writes, (unsigned long) NDATA);
+	if (cached)
+		printf("  cache: %d sets x %d ways, %.1f%% hits, %lu dirty evictions, "
+		       "%lu blocks in %lu write commands, %lu erases\n",
+		       SD_CACHE_SETS, SD_CACHE_WAYS,
+		       100.0 * cache.stats.hits / (cache.stats.hits + cache.stats.misses),
+		       cache.stats.evictions, cache.stats.writebacks,
+		       cache.stats.runs, cache.stats.erases);
+	printf("  card: %lu commands, %lu blocks read, %lu written, %lu erased\n",
+	       st.commands, st.blocks_read, st.blocks_written, st.blocks_erased);
+	printf("  write amplification %.2f blocks per data block, %llu bytes clocked, %.1f ms\n",
+	       (double) st.blocks_written / NDATA, st.bytes, st.ns / 1e6);
+
+	verify();
+	sd_emu_close();
+}
+
+ANTARES_APP(spisd_cache_bench)
+{
+	shadow = malloc(NBLOCKS * 512);
+	if (!shadow)
+		exit(1);
+	run(0);
+	run(1);
+	unlink(IMAGE);
+	printf("spisd-cache-bench: contents verified\n");
+	exit(0);
+}
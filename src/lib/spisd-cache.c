@@ -0,0 +1,204 @@
+#include <string.h>
+#include <lib/spisd.h>
+#include <lib/spisd-cache.h>
+
+#define SETS SD_CACHE_SETS
+#define WAYS SD_CACHE_WAYS
+#define ERASE_MIN CONFIG_LIB_SPISD_CACHE_ERASE_MIN
+
+#if SETS & (SETS - 1)
+#error "CONFIG_LIB_SPISD_CACHE_SETS must be a power of 2"
+#endif
+
+#define set_of(c, block) ((c)->line[(block) & (SETS - 1)])
+
+struct run {
+	struct sd_cache_line **line;
+	unsigned long start;
+	int count;
+};
+
+static struct sd_cache_line *lookup(struct sd_cache *c, unsigned long block)
+{
+	struct sd_cache_line *set = set_of(c, block);
+	int i;
+	for (i = 0; i < WAYS; i++)
+		if ((set[i].flags & SD_CACHE_VALID) && set[i].block == block)
+			return &set[i];
+	return NULL;
+}
+
+static struct sd_cache_line *dirty(struct sd_cache *c, unsigned long block)
+{
+	struct sd_cache_line *l = lookup(c, block);
+	return (l && (l->flags & SD_CACHE_DIRTY)) ? l : NULL;
+}
+
+static const char *run_next(void *arg, unsigned long block)
+{
+	struct run *r = arg;
+	return r->line[block - r->start]->data;
+}
+
+/* Writes out r->count consecutive dirty lines with as few commands as we can */
+static unsigned char run_write(struct sd_cache *c, struct run *r)
+{
+	unsigned char ret;
+	int i;
+
+	if (ERASE_MIN && r->count >= ERASE_MIN) {
+		/* Hint that the whole range is going to be rewritten */
+		if (!sd_erase(c->sd, r->start, r->count))
+			c->stats.erases++;
+	}
+
+	if (r->count == 1)
+		ret = sd_write(c->sd, r->start, r->line[0]->data);
+	else
+		ret = sd_write_stream(c->sd, r->start, r->count, run_next, r);
+	if (ret)
+		return ret;
+
+	for (i = 0; i < r->count; i++)
+		r->line[i]->flags &= ~SD_CACHE_DIRTY;
+	c->stats.writebacks += r->count;
+	c->stats.runs++;
+	return 0;
+}
+
+/* The run of dirty blocks around l goes along with it */
+static unsigned char writeback(struct sd_cache *c, struct sd_cache_line *l)
+{
+	struct sd_cache_line *line[SETS * WAYS];
+	struct run r = { line, 0, 0 };
+	unsigned long first = l->block, last = l->block;
+
+	while (first && (last - first + 1 < SETS * WAYS) && dirty(c, first - 1))
+		first--;
+	while ((last - first + 1 < SETS * WAYS) && dirty(c, last + 1))
+		last++;
+
+	r.start = first;
+	for (; first <= last; first++)
+		line[r.count++] = dirty(c, first);
+	return run_write(c, &r);
+}
+
+/* The line for block, evicting the least recently used one if need be */
+static struct sd_cache_line *alloc(struct sd_cache *c, unsigned long block,
+				   unsigned char *err)
+{
+	struct sd_cache_line *set = set_of(c, block);
+	struct sd_cache_line *victim = &set[0];
+	int i;
+
+	*err = 0;
+	for (i = 0; i < WAYS; i++) {
+		if (!(set[i].flags & SD_CACHE_VALID)) {
+			victim = &set[i];
+			break;
+		}
+		if (set[i].stamp < victim->stamp)
+			victim = &set[i];
+	}
+
+	if (victim->flags & SD_CACHE_DIRTY) {
+		c->stats.evictions++;
+		*err = writeback(c, victim);
+		if (*err)
+			return NULL;
+	}
+	victim->flags = 0;
+	victim->block = block;
+	return victim;
+}
+
+void sd_cache_init(struct sd_cache *c, struct sd_card *sd)
+{
+	memset(c, 0, sizeof(*c));
+	c->sd = sd;
+}
+
+unsigned char sd_cache_read(struct sd_cache *c, unsigned long block, char *buf)
+{
+	struct sd_cache_line *l = lookup(c, block);
+	unsigned char ret;
+
+	if (l) {
+		c->stats.hits++;
+	} else {
+		c->stats.misses++;
+		l = alloc(c, block, &ret);
+		if (!l)
+			return ret;
+		ret = sd_read(c->sd, block, l->data);
+		if (ret)
+			return ret;
+		l->flags = SD_CACHE_VALID;
+	}
+	l->stamp = ++c->tick;
+	memcpy(buf, l->data, 512);
+	return 0;
+}
+
+unsigned char sd_cache_write(struct sd_cache *c, unsigned long block, const char *buf)
+{
+	struct sd_cache_line *l = lookup(c, block);
+	unsigned char ret;
+
+	if (l) {
+		c->stats.hits++;
+	} else {
+		/* Whole block, nothing to read first */
+		c->stats.misses++;
+		l = alloc(c, block, &ret);
+		if (!l)
+			return ret;
+	}
+	memcpy(l->data, buf, 512);
+	l->flags = SD_CACHE_VALID | SD_CACHE_DIRTY;
+	l->stamp = ++c->tick;
+	return 0;
+}
+
+unsigned char sd_cache_flush(struct sd_cache *c)
+{
+	struct sd_cache_line *sorted[SETS * WAYS], *l;
+	struct run r;
+	int s, w, i, n = 0;
+	unsigned char ret;
+
+	/*
+	 * Dirty lines sorted by block, then cut into consecutive runs.
+	 * Moving along r.line rather than indexing sorted[] keeps gcc from
+	 * seeing out of bounds accesses that can't happen with one line
+	 */
+	for (s = 0; s < SETS; s++)
+		for (w = 0; w < WAYS; w++) {
+			l = &c->line[s][w];
+			if (!(l->flags & SD_CACHE_DIRTY))
+				continue;
+			r.line = &sorted[n++];
+			for (; r.line > sorted && r.line[-1]->block > l->block;
+			     r.line--)
+				r.line[0] = r.line[-1];
+			r.line[0] = l;
+		}
+
+	for (i = 0; i < n; i += r.count) {
+		r.line = &sorted[i];
+		r.start = r.line[0]->block;
+		for (r.count = 1; i + r.count < n; r.count++)
+			if (r.line[r.count]->block != r.start + r.count)
+				break;
+		ret = run_write(c, &r);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+void sd_cache_invalidate(struct sd_cache *c)
+{
+	memset(c->line, 0, sizeof(c->line));
+}
@@ -0,0 +1,174 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <arch/antares.h>
+#include <lib/spisd.h>
+#include <lib/spisd-emu.h>
+
+/*
+ * Runs every spisd transfer path against the emulator, checks what
+ * comes back and times it on the emulator's clock.
+ */
+
+#define N       CONFIG_LIB_SPISD_EMU_BENCH_BLOCKS
+#define IMAGE   CONFIG_LIB_SPISD_EMU_BENCH_IMAGE
+#define NBLOCKS ((2 * N + 1023) & ~1023)
+
+static struct sd_card card;
+static struct sd_emu_stats t0;
+static char *buf;
+static int errors;
+
+static void fill(char *p, unsigned long block, int seed)
+{
+	int i;
+	for (i = 0; i < 512; i++)
+		p[i] = block * seed + i;
+}
+
+static int check(const char *p, unsigned long block, int seed)
+{
+	char want[512];
+	fill(want, block, seed);
+	if (memcmp(p, want, 512)) {
+		fprintf(stderr, "spisd-emu-bench: block %lu is wrong\n", block);
+		errors++;
+		return 1;
+	}
+	return 0;
+}
+
+static void fail(const char *what, int ret)
+{
+	fprintf(stderr, "spisd-emu-bench: %s failed: %d\n", what, ret);
+	errors++;
+}
+
+static void start()
+{
+	t0 = sd_emu_stats;
+}
+
+static void report(const char *what, unsigned long blocks)
+{
+	double s = (sd_emu_stats.ns - t0.ns) / 1e9;
+	printf("%-24s %5lu blocks %8.1f ms %7.0f KB/s %6lu commands %5.1f%% busy\n",
+	       what, blocks, s * 1e3, blocks / 2.0 / s,
+	       sd_emu_stats.commands - t0.commands,
+	       100.0 * (sd_emu_stats.busy_bytes - t0.busy_bytes) /
+	       (sd_emu_stats.bytes - t0.bytes));
+}
+
+static int consume(void *arg, unsigned long block, char *data)
+{
+	return check(data, block, 7);
+}
+
+static long long allocated()
+{
+	struct stat st;
+	if (stat(IMAGE, &st))
+		return -1;
+	return (long long) st.st_blocks * 512;
+}
+
+ANTARES_APP(spisd_emu_bench)
+{
+	struct sd_info info;
+	char two[1024];
+	unsigned long i;
+	int ret;
+
+	buf = malloc(N * 512);
+	unlink(IMAGE);
+	if (!buf || sd_emu_open(IMAGE, NBLOCKS))
+		exit(1);
+	sd_emu_attach(&card);
+
+	start();
+	ret = sd_init(&card);
+	if (ret || !sd_is_shdc(&card))
+		fail("init", ret);
+	printf("init: %.1f ms\n", (sd_emu_stats.ns - t0.ns) / 1e6);
+
+	ret = sd_read_info(&card, &info);
+	if (ret)
+		fail("read_info", ret);
+	if (info.capacity != (uint64_t) NBLOCKS * 512 ||
+	    memcmp(info.product, "EMUSD", 5))
+		fail("card info", 0);
+	printf("card: %.5s, %llu bytes, made %d-%02d\n", info.product,
+	       (unsigned long long) info.capacity,
+	       2000 + info.manufacturing_year, info.manufacturing_month);
+
+	start();
+	for (i = 0; i < N; i++) {
+		fill(buf, i, 3);
+		ret = sd_write(&card, i, buf);
+		if (ret) {
+			fail("sd_write", ret);
+			break;
+		}
+	}
+	report("sd_write", N);
+
+	start();
+	for (i = 0; i < N; i++) {
+		ret = sd_read(&card, i, buf);
+		if (ret) {
+			fail("sd_read", ret);
+			break;
+		}
+		check(buf, i, 3);
+	}
+	report("sd_read", N);
+
+	for (i = 0; i < N; i++)
+		fill(&buf[i * 512], N + i, 7);
+	start();
+	ret = sd_multiwrite(&card, N, N, buf);
+	if (ret)
+		fail("sd_multiwrite", ret);
+	report("sd_multiwrite", N);
+
+	memset(buf, 0, N * 512);
+	start();
+	ret = sd_multiread(&card, N, N, buf);
+	if (ret)
+		fail("sd_multiread", ret);
+	report("sd_multiread", N);
+	for (i = 0; i < N; i++)
+		check(&buf[i * 512], N + i, 7);
+
+	start();
+	ret = sd_read_stream(&card, N, N, two, consume, NULL);
+	if (ret)
+		fail("sd_read_stream", ret);
+	report("sd_read_stream", N);
+
+	printf("image: %lld bytes allocated\n", allocated());
+	start();
+	ret = sd_erase(&card, 0, N);
+	if (ret)
+		fail("sd_erase", ret);
+	report("sd_erase", N);
+	printf("image: %lld bytes allocated after erase\n", allocated());
+
+	ret = sd_read(&card, N - 1, buf);
+	for (i = 0; i < 512 && !buf[i]; i++);;
+	if (ret || i != 512)
+		fail("reading erased block", ret);
+	ret = sd_read(&card, N, buf);
+	if (ret || check(buf, N, 7))
+		fail("reading past the erased range", ret);
+	if (!sd_read(&card, NBLOCKS, buf))
+		fail("reading past the end", 0);
+
+	sd_emu_close();
+	unlink(IMAGE);
+	free(buf);
+	printf("spisd-emu-bench: %s\n", errors ? "FAILED" : "all good");
+	exit(errors ? 1 : 0);
+}
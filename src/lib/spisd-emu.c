@@ -0,0 +1,424 @@
+/*
+ * SPI mode SD card emulator, native arch only.
+ * Enough of the protocol for spisd: init, CSD/CID, single and
+ * multiple block reads and writes, erase. The card is SDHC, so
+ * block addressed.
+ *
+ * Time is virtual. Every byte clocked advances it by 8 bits at the
+ * speed spisd asked for, and the card's access, programming and
+ * erase times are counted against it: data tokens don't show up and
+ * busy doesn't go away until enough bytes have been clocked.
+ */
+
+#define _GNU_SOURCE /* fallocate() */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <generic/macros.h>
+#include <lib/spisd.h>
+#include <lib/spisd-emu.h>
+
+#define R1_IDLE       0x01
+#define R1_ILLEGAL    0x04
+#define R1_ADDRESS    0x20
+
+#define NS(us)        ((unsigned long long) (us) * 1000)
+#define READ_NS       NS(CONFIG_LIB_SPISD_EMU_READ_US)
+#define WRITE_NS      NS(CONFIG_LIB_SPISD_EMU_WRITE_US)
+#define STREAM_NS     NS(CONFIG_LIB_SPISD_EMU_STREAM_US)
+#define ERASE_NS      NS(CONFIG_LIB_SPISD_EMU_ERASE_US)
+
+enum {
+	EMU_CMD = 0,
+	EMU_READ_MULTI,
+	EMU_WRITE_TOKEN,
+	EMU_WRITE_DATA,
+};
+
+struct sd_emu_stats sd_emu_stats;
+
+static int fd = -1;
+static unsigned long nblocks;
+
+static int selected, idle, app, state, multi;
+static unsigned char cmd[6];
+static int cmd_len;
+
+/* What goes out on MISO next. Room for a token, a block and CRC */
+static unsigned char out[520];
+static int out_len, out_pos;
+/* out[hold] onwards waits for the access time */
+static int hold = -1;
+static unsigned long long hold_until, busy_until;
+static unsigned int byte_ns;
+/* Not the one in the stats, those get reset */
+static unsigned long long now;
+
+static unsigned long block, erase_start, erase_end;
+static unsigned char wbuf[512 + 2];
+static int wpos;
+
+static void q(unsigned char b)
+{
+	out[out_len++] = b;
+}
+
+static void q_reset()
+{
+	out_len = out_pos = 0;
+	hold = -1;
+}
+
+static unsigned char crc7(const unsigned char *p, int len)
+{
+	unsigned char crc = 0;
+	int i;
+	while (len--) {
+		crc ^= *p++;
+		for (i = 0; i < 8; i++)
+			crc = (crc & 0x80) ? (crc << 1) ^ 0x12 : crc << 1;
+	}
+	return crc | 1;
+}
+
+static int read_block(unsigned long n, unsigned char *buf)
+{
+	ssize_t got = pread(fd, buf, 512, (off_t) n * 512);
+	if (got < 0)
+		return -1;
+	/* Past the end of a sparse image reads as zeroes */
+	memset(&buf[got], 0, 512 - got);
+	sd_emu_stats.blocks_read++;
+	return 0;
+}
+
+/* Zeroes are holes in the image, so erased space stays unallocated */
+static int zero_blocks(unsigned long n, unsigned long count)
+{
+	static const unsigned char zero[512];
+	if (!fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+		       (off_t) n * 512, (off_t) count * 512))
+		return 0;
+	for (; count; count--, n++)
+		if (pwrite(fd, zero, 512, (off_t) n * 512) != 512)
+			return -1;
+	return 0;
+}
+
+static int write_block(unsigned long n, const unsigned char *buf)
+{
+	int i;
+	sd_emu_stats.blocks_written++;
+	for (i = 0; i < 512 && !buf[i]; i++);;
+	if (i == 512)
+		return zero_blocks(n, 1);
+	return (pwrite(fd, buf, 512, (off_t) n * 512) == 512) ? 0 : -1;
+}
+
+/* Register or block, behind a start token and the access time */
+static void q_data(const unsigned char *data, int len)
+{
+	q(0xff); /* Nac */
+	hold = out_len;
+	hold_until = now + READ_NS;
+	q(0xfe);
+	if (data)
+		memcpy(&out[out_len], data, len);
+	out_len += len;
+	q(0xff); /* CRC16, nobody checks */
+	q(0xff);
+}
+
+static void q_block(unsigned long n)
+{
+	if (n >= nblocks || read_block(n, &out[out_len + 2])) {
+		q(0xff);
+		q(0x08); /* Data error token, out of range */
+		return;
+	}
+	q_data(NULL, 512);
+}
+
+static void q_csd()
+{
+	unsigned long c_size = (nblocks >> 10) - 1;
+	unsigned char csd[16] = {
+		0x40,           /* CSD 2.0 */
+		0x0e, 0x00,     /* TAAC, NSAC: fixed for 2.0 */
+		0x32,           /* 25 MHz */
+		0x5b, 0x59,     /* CCC, READ_BL_LEN 9 */
+		0x00,
+		(c_size >> 16) & 0x3f, c_size >> 8, c_size,
+		0x7f, 0x80,     /* ERASE_BLK_EN, SECTOR_SIZE */
+		0x0a, 0x40,     /* R2W_FACTOR, WRITE_BL_LEN 9 */
+		0x00,
+	};
+	csd[15] = crc7(csd, 15);
+	q_data(csd, 16);
+}
+
+static void q_cid()
+{
+	unsigned char cid[16] = {
+		0x41, 'A', 'N',                 /* Manufacturer, OEM */
+		'E', 'M', 'U', 'S', 'D',        /* Product */
+		0x10,                           /* Revision 1.0 */
+		0x00, 0x00, 0x00, 0x01,         /* Serial */
+		0x01, 0x8a,                     /* Made 2024-10 */
+	};
+	cid[15] = crc7(cid, 15);
+	q_data(cid, 16);
+}
+
+static int erase()
+{
+	unsigned long last = min_t(unsigned long, erase_end, nblocks - 1);
+	if (erase_start > last)
+		return -1;
+	sd_emu_stats.blocks_erased += last - erase_start + 1;
+	return zero_blocks(erase_start, last - erase_start + 1);
+}
+
+static void command()
+{
+	unsigned long arg = ((unsigned long) cmd[1] << 24) | (cmd[2] << 16) |
+		(cmd[3] << 8) | cmd[4];
+	int c = cmd[0] & 0x3f;
+	int acmd = app;
+	unsigned char r1 = idle ? R1_IDLE : 0;
+
+	sd_emu_stats.commands++;
+	app = 0;
+	q_reset();
+	q(0xff); /* Ncr */
+
+	if (acmd && c == 41) {
+		idle = 0;
+		q(0);
+		return;
+	}
+
+	switch (c) {
+	case 0:
+		idle = 1;
+		state = EMU_CMD;
+		q(R1_IDLE);
+		break;
+	case 8:
+		q(r1);
+		q(0);
+		q(0);
+		q(cmd[3] & 0x0f);
+		q(cmd[4]);
+		break;
+	case 55:
+		app = 1;
+		q(r1);
+		break;
+	case 58:
+		q(r1);
+		q(idle ? 0x40 : 0xc0); /* Powered up, CCS */
+		q(0xff);
+		q(0x80);
+		q(0x00);
+		break;
+	case 13:
+		q(r1);
+		q(0);
+		break;
+	case 16:
+	case 59:
+		q(r1);
+		break;
+	case 9:
+		q(r1);
+		q_csd();
+		break;
+	case 10:
+		q(r1);
+		q_cid();
+		break;
+	case 12:
+		/* Comes in while data is going out, which stops right away */
+		state = EMU_CMD;
+		q(r1);
+		busy_until = now + STREAM_NS;
+		break;
+	case 17:
+	case 18:
+		if (arg >= nblocks) {
+			q(r1 | R1_ADDRESS);
+			break;
+		}
+		q(r1);
+		block = arg;
+		q_block(block++);
+		if (c == 18)
+			state = EMU_READ_MULTI;
+		break;
+	case 24:
+	case 25:
+		if (arg >= nblocks) {
+			q(r1 | R1_ADDRESS);
+			break;
+		}
+		q(r1);
+		block = arg;
+		multi = (c == 25);
+		state = EMU_WRITE_TOKEN;
+		break;
+	case 32:
+		erase_start = arg;
+		q(r1);
+		break;
+	case 33:
+		erase_end = arg;
+		q(r1);
+		break;
+	case 38:
+		q(erase() ? (r1 | R1_ADDRESS) : r1);
+		busy_until = now + ERASE_NS;
+		break;
+	default:
+		q(r1 | R1_ILLEGAL);
+		break;
+	}
+}
+
+static void emu_data(unsigned char b)
+{
+	switch (state) {
+	case EMU_WRITE_TOKEN:
+		if ((b == 0xfe && !multi) || (b == 0xfc && multi)) {
+			state = EMU_WRITE_DATA;
+			wpos = 0;
+		} else if (b == 0xfd && multi) {
+			/* Stop tran: one byte, then busy */
+			state = EMU_CMD;
+			q_reset();
+			q(0xff);
+			busy_until = now + WRITE_NS;
+		}
+		break;
+	case EMU_WRITE_DATA:
+		wbuf[wpos++] = b;
+		if (wpos < sizeof(wbuf))
+			break;
+		q_reset();
+		if (block < nblocks && !write_block(block, wbuf)) {
+			q(0xe5); /* Data accepted */
+			block++;
+			/* Multiple block writes program in the background */
+			busy_until = now + (multi ? STREAM_NS : WRITE_NS);
+		} else {
+			q(0xed); /* Write error */
+		}
+		state = multi ? EMU_WRITE_TOKEN : EMU_CMD;
+		break;
+	}
+}
+
+static unsigned char emu_xfer(unsigned char b)
+{
+	unsigned char r = 0xff;
+
+	sd_emu_stats.bytes++;
+	sd_emu_stats.ns += byte_ns;
+	now += byte_ns;
+	if (!selected)
+		return 0xff; /* MISO floats high */
+
+	if (out_pos < out_len) {
+		if (out_pos != hold || now >= hold_until)
+			r = out[out_pos++];
+	} else if (now < busy_until) {
+		sd_emu_stats.busy_bytes++;
+		r = 0x00;
+	} else if (state == EMU_READ_MULTI) {
+		q_reset();
+		q_block(block++);
+		r = out[out_pos++];
+	}
+
+	if (state == EMU_WRITE_TOKEN || state == EMU_WRITE_DATA) {
+		emu_data(b);
+	} else if (cmd_len || (b & 0xc0) == 0x40) {
+		cmd[cmd_len++] = b;
+		if (cmd_len == sizeof(cmd)) {
+			cmd_len = 0;
+			command();
+		}
+	}
+	return r;
+}
+
+static void emu_xfer_block(const char *tx, char *rx, int len)
+{
+	unsigned char b;
+	int i;
+	for (i = 0; i < len; i++) {
+		b = emu_xfer(tx ? tx[i] : 0xff);
+		if (rx)
+			rx[i] = b;
+	}
+}
+
+static void emu_cs(int select)
+{
+	selected = select;
+	if (!select)
+		cmd_len = 0;
+}
+
+/* In kHz */
+static void emu_set_speed(int speed)
+{
+	byte_ns = 8000000 / speed;
+}
+
+int sd_emu_open(const char *path, unsigned long blocks)
+{
+	if (!blocks || (blocks & 1023)) {
+		fprintf(stderr, "%s: size must be a multiple of 1024 blocks\n", path);
+		return -1;
+	}
+	sd_emu_close();
+	fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (fd < 0) {
+		perror(path);
+		return -1;
+	}
+	/* Grows it sparse, blocks never written cost nothing */
+	if (ftruncate(fd, (off_t) blocks * 512)) {
+		perror(path);
+		sd_emu_close();
+		return -1;
+	}
+	nblocks = blocks;
+	memset(&sd_emu_stats, 0, sizeof(sd_emu_stats));
+	idle = 1;
+	app = 0;
+	busy_until = 0;
+	byte_ns = 8000000 / 400;
+	state = EMU_CMD;
+	cmd_len = 0;
+	q_reset();
+	return 0;
+}
+
+void sd_emu_close(void)
+{
+	if (fd >= 0)
+		close(fd);
+	fd = -1;
+}
+
+void sd_emu_attach(struct sd_card *sd)
+{
+	memset(sd, 0, sizeof(*sd));
+	sd->cs = emu_cs;
+	sd->xfer = emu_xfer;
+	sd->set_speed = emu_set_speed;
+	sd->xfer_block = emu_xfer_block;
+}
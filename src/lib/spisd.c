@@ -35,6 +35,34 @@
 
 
 
+/* Bulk transfers, through xfer_block if the driver has one */
+static void data_start(struct sd_card *sd, const char *tx, char *rx, int len)
+{
+	unsigned char b;
+	int i;
+	if (sd->xfer_block) {
+		sd->xfer_block(tx, rx, len);
+		return;
+	}
+	for (i = 0; i < len; i++) {
+		b = sd->xfer(tx ? tx[i] : 0xff);
+		if (rx)
+			rx[i] = b;
+	}
+}
+
+static void data_wait(struct sd_card *sd)
+{
+	if (sd->xfer_block && sd->xfer_wait)
+		sd->xfer_wait();
+}
+
+static void data_xfer(struct sd_card *sd, const char *tx, char *rx, int len)
+{
+	data_start(sd, tx, rx, len);
+	data_wait(sd);
+}
+
 #include <lib/printk.h>
 int sd_read_info(struct sd_card *sd, struct sd_info *info)
 {
@@ -350,6 +378,7 @@ unsigned char sd_cmd(struct sd_card* sd, unsigned char cmd, unsigned long arg)
 unsigned char sd_erase (struct sd_card *sd, unsigned long start_block, unsigned long num_blocks)
 {
         unsigned char response;
+        unsigned long retry=0;
 
         response = sd_cmd(sd, ERASE_BLOCK_START_ADDR, start_block); 
         if(response != 0x00) 
@@ -363,6 +392,16 @@ unsigned char sd_erase (struct sd_card *sd, unsigned long start_block, unsigned
         if(response != 0x00)
                 return response;
 
+        /* R1b, the card holds the line low until it's done. Erasing
+         * takes a lot longer than a write, hence the larger bound */
+        while(!sd->xfer(0xff))
+                if(retry++ > 0xfffffe) {
+                        sd->cs(0);
+                        return 1;
+                }
+        sd->cs(0);
+        sd->xfer(0xff);
+
         return 0;
 }
 
@@ -380,7 +419,7 @@ unsigned char sd_erase (struct sd_card *sd, unsigned long start_block, unsigned
 unsigned char sd_read(struct sd_card *sd, unsigned long block, char* buf)
 {
         unsigned char response;
-        unsigned int i, retry=0;
+        unsigned int retry=0;
 
         response = sd_cmd(sd, READ_SINGLE_BLOCK, block); 
 
@@ -396,8 +435,7 @@ unsigned char sd_read(struct sd_card *sd, unsigned long block, char* buf)
                         return 1;
                 }
 	
-        for(i=0; i<512; i++) 
-                buf[i] = sd->xfer(0xff);
+        data_xfer(sd, NULL, buf, 512);
 	
         sd->xfer(0xff); /* TODO: Check CRC16 */
         sd->xfer(0xff);
@@ -422,7 +460,7 @@ unsigned char sd_read(struct sd_card *sd, unsigned long block, char* buf)
 unsigned char sd_write(struct sd_card *sd, unsigned long block, char* buf)
 {
         unsigned char response;
-        unsigned int i, retry=0;
+        unsigned int retry=0;
 
         response = sd_cmd(sd, WRITE_SINGLE_BLOCK, block); 
 
@@ -433,8 +471,7 @@ unsigned char sd_write(struct sd_card *sd, unsigned long block, char* buf)
 
         sd->xfer(0xfe);
 
-        for(i=0; i<512; i++)
-                sd->xfer(buf[i]);
+        data_xfer(sd, buf, NULL, 512);
 
         sd->xfer(0xff);     /* TODO: CRC16 Here */
         sd->xfer(0xff);
@@ -483,7 +520,7 @@ unsigned char sd_multiread (struct sd_card *sd,
 			    char* buffer)
 {
         unsigned char response;
-        unsigned int i, j=0, retry=0;
+        unsigned int j=0, retry=0;
 
         retry = 0;
 	
@@ -502,8 +539,8 @@ unsigned char sd_multiread (struct sd_card *sd,
                                 return 1;
                         }
 
-                for(i=0; i<512; i++) 
-                        buffer[j++] = sd->xfer(0xff);
+                data_xfer(sd, NULL, &buffer[j], 512);
+                j += 512;
 
                 sd->xfer(0xff);
                 sd->xfer(0xff);
@@ -520,6 +557,17 @@ unsigned char sd_multiread (struct sd_card *sd,
         return 0;
 }
 
+struct multiwrite_buf {
+	char *buffer;
+	unsigned long start;
+};
+
+static const char *multiwrite_next(void *arg, unsigned long block)
+{
+	struct multiwrite_buf *b = arg;
+	return &b->buffer[(block - b->start) * 512];
+}
+
 /** 
  * Write multiple blocks to SD from a user-supplied buffer
  * 
@@ -535,64 +583,152 @@ unsigned char sd_multiwrite(struct sd_card *sd,
 			    unsigned long total_blocks, 
 			    char* buffer)
 {
-        unsigned char response;
-        unsigned int i, j=0, retry=0;
+	struct multiwrite_buf b = { buffer, start_block };
+	return sd_write_stream(sd, start_block, total_blocks,
+			       multiwrite_next, &b);
+}
+
+/** 
+ * Write multiple blocks, asking a callback for each one in turn.
+ * With an asynchronous xfer_block produce() is called for the next
+ * block while the current one is being sent, and must not touch the
+ * SPI bus. The data it returns must stay put until it's sent.
+ *
+ * @param sd sd_card instance
+ * @param start_block start block
+ * @param block_count number of blocks
+ * @param produce returns the 512 bytes to write to a block
+ * @param arg passed to produce
+ * 
+ * @return 0 on success, card response otherwise
+ */
+unsigned char sd_write_stream(struct sd_card *sd,
+			      unsigned long start_block,
+			      unsigned long block_count,
+			      const char *(*produce)(void *arg, unsigned long block),
+			      void *arg)
+{
+	unsigned char response;
+	unsigned long n;
+	unsigned int retry;
+	const char *data, *next;
 
-        response = sd_cmd(sd, WRITE_MULTIPLE_BLOCKS, start_block);
+	if (!block_count)
+		return 0;
 
-        if(response != 0x00) 
+	response = sd_cmd(sd, WRITE_MULTIPLE_BLOCKS, start_block);
+	if (response != 0x00)
 		return response;
 
-        sd->cs(1);
-	
-        while( total_blocks ) {
-                i=0;
-                sd->xfer(0xfc); 
+	sd->cs(1);
 
-                for(i=0; i<512; i++) 
-                        sd->xfer( buffer[j++] );
+	data = produce(arg, start_block);
+	for (n = 0; n < block_count; n++) {
+		sd->xfer(0xfc);
+		data_start(sd, data, NULL, 512);
+		next = (n + 1 < block_count) ? produce(arg, start_block + n + 1) : NULL;
+		data_wait(sd);
 
-                sd->xfer(0xff);
-                sd->xfer(0xff);
+		sd->xfer(0xff); /* TODO: CRC16 Here */
+		sd->xfer(0xff);
 
-                response = sd->xfer(0xff);
-                if( (response & 0x1f) != 0x05) { 
-                        sd->cs(0);
-                        return response;
-                }
+		response = sd->xfer(0xff);
+		if ((response & 0x1f) != 0x05) {
+			sd->cs(0);
+			return response;
+		}
 
-                while (!sd->xfer(0xff)) 
-                        if(retry++ > 0xfffe) {
-                                sd->cs(0);
-                                return 1;
-                        }
+		retry = 0;
+		while (!sd->xfer(0xff))
+			if (retry++ > 0xfffe) {
+				sd->cs(0);
+				return 1;
+			}
 
-                sd->xfer(0xff);
-                total_blocks--;
-        }
+		sd->xfer(0xff);
+		data = next;
+	}
 
-        sd->xfer(0xfd);
+	sd->xfer(0xfd);
 
-        retry = 0;
+	retry = 0;
 
-        while(!sd->xfer(0xff)) 
-                if(retry++ > 0xfffe) {
-                        sd->cs(0);
-                        return 1;
-                }
+	while (!sd->xfer(0xff))
+		if (retry++ > 0xfffe) {
+			sd->cs(0);
+			return 1;
+		}
 
-        sd->cs(0);
-        sd->xfer(0xff); 
-        sd->cs(1); 
+	sd->cs(0);
+	sd->xfer(0xff);
+	sd->cs(1);
 
-        while(!sd->xfer(0xff)) 
-                if(retry++ > 0xfffe) {
-                        sd->cs(0);
-                        return 1;
-                }
-        sd->cs(0);
-	
-        return 0;
+	while (!sd->xfer(0xff))
+		if (retry++ > 0xfffe) {
+			sd->cs(0);
+			return 1;
+		}
+	sd->cs(0);
+
+	return 0;
 }
 
+/** 
+ * Read multiple blocks, passing each one to a callback as it comes.
+ * With an asynchronous xfer_block the next block is already on its
+ * way while consume() runs, so consume() must not touch the SPI bus.
+ *
+ * @param sd sd_card instance
+ * @param start_block starting block
+ * @param block_count number of blocks to read
+ * @param buf two blocks (1024 bytes) of buffer space
+ * @param consume called with each block, non-zero stops the read
+ * @param arg passed to consume
+ * 
+ * @return 0 on success, card response otherwise
+ */
+unsigned char sd_read_stream(struct sd_card *sd,
+			     unsigned long start_block,
+			     unsigned long block_count,
+			     char* buf,
+			     int (*consume)(void *arg, unsigned long block, char *data),
+			     void *arg)
+{
+	unsigned char response;
+	unsigned long n;
+	unsigned int retry;
+	char *cur = buf, *prev = NULL;
+	int stop = 0;
+
+	response = sd_cmd(sd, READ_MULTIPLE_BLOCKS, start_block);
+	if (response != 0x00)
+		return response;
+
+	sd->cs(1);
 
+	for (n = 0; (n < block_count) && !stop; n++) {
+		retry = 0;
+		while (sd->xfer(0xff) != 0xfe)
+			if (retry++ > 0xfffe) {
+				response = 1;
+				goto out;
+			}
+		data_start(sd, NULL, cur, 512);
+		if (prev)
+			stop = consume(arg, start_block + n - 1, prev);
+		data_wait(sd);
+		sd->xfer(0xff); /* TODO: Check CRC16 */
+		sd->xfer(0xff);
+		prev = cur;
+		cur = (cur == buf) ? &buf[512] : buf;
+	}
+	if (prev && !stop)
+		consume(arg, start_block + n - 1, prev);
+
+out:
+	sd_cmd(sd, STOP_TRANSMISSION, 0);
+	sd->cs(0);
+	sd->xfer(0xff);
+
+	return response;
+}
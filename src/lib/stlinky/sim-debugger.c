@@ -0,0 +1,185 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/time.h>
+#include <arch/antares.h>
+#include <lib/stlinky.h>
+
+/*
+ * Plays the ST-Link side of the terminal. Every timer tick is one
+ * memory access over SWD, which is what costs time with a real
+ * debugger: reading the structure, or writing one field or block
+ * back. Meanwhile the target streams a known pattern out and checks
+ * the one the 'debugger' sends in.
+ */
+
+#define LATENCY CONFIG_LIB_STLINKY_SIM_LATENCY
+#define NBYTES  CONFIG_LIB_STLINKY_SIM_BYTES
+
+#define st (&g_stlinky_term)
+
+static unsigned char pattern(unsigned int i)
+{
+	return (i * 7 + (i >> 8)) & 0xff;
+}
+
+enum {
+	POLL = 0,
+	ACK_TX,
+	PUT_RX,
+	PUT_RX_INDEX
+};
+
+static volatile int state;
+static volatile unsigned long accesses;
+static volatile unsigned int tx_got, rx_put, tx_errors;
+static unsigned int chunk;
+
+#ifndef CONFIG_LIB_STLINKY_V2
+
+static void debugger_tick()
+{
+	int i, n;
+	accesses++;
+	switch (state) {
+	case POLL:
+		/* One block read of the whole thing */
+		n = st->txsize;
+		for (i = 0; i < n; i++)
+			if (st->txbuf[i] != (char) pattern(tx_got++))
+				tx_errors++;
+		if (n)
+			state = ACK_TX;
+		else if ((rx_put < NBYTES) && !st->rxsize)
+			state = PUT_RX;
+		break;
+	case ACK_TX:
+		st->txsize = 0;
+		state = ((rx_put < NBYTES) && !st->rxsize) ? PUT_RX : POLL;
+		break;
+	case PUT_RX:
+		chunk = NBYTES - rx_put;
+		if (chunk > CONFIG_LIB_STLINKY_BSIZE)
+			chunk = CONFIG_LIB_STLINKY_BSIZE;
+		for (i = 0; i < chunk; i++)
+			st->rxbuf[i] = pattern(rx_put + i);
+		state = PUT_RX_INDEX;
+		break;
+	case PUT_RX_INDEX:
+		st->rxsize = chunk;
+		rx_put += chunk;
+		state = POLL;
+		break;
+	}
+}
+
+#else
+
+static void debugger_tick()
+{
+	uint32_t head, tail;
+	int i;
+	accesses++;
+	switch (state) {
+	case POLL:
+		/* One block read of the indices and the TX ring */
+		head = st->txhead;
+		for (tail = st->txtail; tail != head; tail++)
+			if (st->txbuf[tail & (st->txsize - 1)] != (char) pattern(tx_got++))
+				tx_errors++;
+		if (head != st->txtail)
+			state = ACK_TX;
+		else if (rx_put < NBYTES)
+			state = PUT_RX;
+		break;
+	case ACK_TX:
+		st->txtail = tx_got;
+		state = (rx_put < NBYTES) ? PUT_RX : POLL;
+		break;
+	case PUT_RX:
+		/* All the free space, in one block write */
+		chunk = st->rxsize - (st->rxhead - st->rxtail);
+		if (chunk > NBYTES - rx_put)
+			chunk = NBYTES - rx_put;
+		for (i = 0; i < chunk; i++)
+			st->rxbuf[(rx_put + i) & (st->rxsize - 1)] = pattern(rx_put + i);
+		state = chunk ? PUT_RX_INDEX : POLL;
+		break;
+	case PUT_RX_INDEX:
+		rx_put += chunk;
+		st->rxhead = rx_put;
+		state = POLL;
+		break;
+	}
+}
+
+#endif
+
+static void tick(int sig)
+{
+	debugger_tick();
+}
+
+static double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+ANTARES_APP(stlinky_sim)
+{
+	struct itimerval it = {
+		.it_interval = { 0, LATENCY },
+		.it_value = { 0, LATENCY },
+	};
+	/* v1 hands over a whole buffer, whatever we ask for */
+	char buf[256];
+	unsigned int sent = 0, got = 0, rx_errors = 0;
+	double start, t_tx = 0, t_rx = 0;
+	int i, n;
+
+	signal(SIGALRM, tick);
+	setitimer(ITIMER_REAL, &it, NULL);
+	start = now();
+	while ((tx_got < NBYTES) || (got < NBYTES)) {
+		if (sent < NBYTES) {
+			n = NBYTES - sent;
+			if (n > 64)
+				n = 64;
+			for (i = 0; i < n; i++)
+				buf[i] = pattern(sent + i);
+			sent += stlinky_tx(st, buf, n);
+		}
+		if ((got < NBYTES) && stlinky_avail(st)) {
+			n = stlinky_rx(st, buf, sizeof(buf));
+			for (i = 0; i < n; i++)
+				if (buf[i] != (char) pattern(got++))
+					rx_errors++;
+			if (got == NBYTES)
+				t_rx = now() - start;
+		}
+		if (!t_tx && (tx_got == NBYTES))
+			t_tx = now() - start;
+	}
+	it.it_value.tv_usec = it.it_interval.tv_usec = 0;
+	setitimer(ITIMER_REAL, &it, NULL);
+
+#ifdef CONFIG_LIB_STLINKY_V2
+	printf("stlinky: v2, %d byte TX and %d byte RX rings, ",
+	       CONFIG_LIB_STLINKY_TXSIZE, CONFIG_LIB_STLINKY_RXSIZE);
+#else
+	printf("stlinky: v1, %d byte buffers, ", CONFIG_LIB_STLINKY_BSIZE);
+#endif
+	printf("%d us per debugger access\n", LATENCY);
+	printf("stlinky: target -> host %d bytes in %.3f s, %.0f bytes/s, %u errors\n",
+	       NBYTES, t_tx, NBYTES / t_tx, tx_errors);
+	printf("stlinky: host -> target %d bytes in %.3f s, %.0f bytes/s, %u errors\n",
+	       NBYTES, t_rx, NBYTES / t_rx, rx_errors);
+	printf("stlinky: %lu debugger accesses, %.1f bytes each\n",
+	       accesses, 2.0 * NBYTES / accesses);
+	exit((tx_errors || rx_errors) ? 1 : 0);
+}
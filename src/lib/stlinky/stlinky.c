@@ -2,8 +2,10 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <generic/macros.h>
 #include <lib/stlinky.h>
 
+#ifndef CONFIG_LIB_STLINKY_V2
 
 volatile struct stlinky g_stlinky_term = {
 	.magic = STLINKY_MAGIC,
@@ -46,6 +48,75 @@ void stlinky_wait_for_terminal(volatile struct stlinky* st)
 	while(st->txsize != 0);;; 
 }
 
+#else
+
+#define TXSIZE CONFIG_LIB_STLINKY_TXSIZE
+#define RXSIZE CONFIG_LIB_STLINKY_RXSIZE
+
+#if (TXSIZE & (TXSIZE - 1)) || (RXSIZE & (RXSIZE - 1))
+#error "stlinky ring sizes must be powers of 2"
+#endif
+
+volatile struct stlinky g_stlinky_term = {
+	.magic = STLINKY_MAGIC,
+	.txsize = TXSIZE,
+	.rxsize = RXSIZE,
+};
+
+int stlinky_tx(volatile struct stlinky* st, const char* buf, int siz)
+{
+	uint32_t head = st->txhead;
+	int n, left = siz;
+	while (left) {
+		n = TXSIZE - (head - st->txtail);
+		if (!n)
+			continue; /* Full, the debugger will come */
+		n = min_t(int, n, TXSIZE - (head & (TXSIZE - 1)));
+		n = min_t(int, n, left);
+		memcpy((char*) &st->txbuf[head & (TXSIZE - 1)], buf, n);
+		head += n;
+		buf += n;
+		left -= n;
+		barrier();
+		st->txhead = head;
+	}
+	return siz;
+}
+
+int stlinky_rx(volatile struct stlinky* st, char* buf, int siz)
+{
+	uint32_t tail = st->rxtail;
+	int n, done = 0;
+	while (st->rxhead == tail);;;
+	barrier();
+	while (done < siz) {
+		n = st->rxhead - tail;
+		if (!n)
+			break;
+		n = min_t(int, n, RXSIZE - (tail & (RXSIZE - 1)));
+		n = min_t(int, n, siz - done);
+		memcpy(&buf[done], (char*) &st->rxbuf[tail & (RXSIZE - 1)], n);
+		tail += n;
+		done += n;
+	}
+	barrier();
+	st->rxtail = tail;
+	return done;
+}
+
+int stlinky_avail(volatile struct stlinky* st)
+{
+	return st->rxhead - st->rxtail;
+}
+
+void stlinky_wait_for_terminal(volatile struct stlinky* st)
+{
+	stlinky_tx(st, "\n", 1);
+	while (st->txtail != st->txhead);;;
+}
+
+#endif
+
 #ifdef CONFIG_LIB_STLINKY_NLIB
 
 int _write(int file, char *ptr, int len) {
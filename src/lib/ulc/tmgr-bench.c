@@ -0,0 +1,96 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <arch/antares.h>
+#include <lib/tasks.h>
+
+/*
+ * Measures how long tmgr_tick() takes with a lot of
+ * periodic jobs pending.
+ */
+
+#define NJOBS     CONFIG_LIB_TMGR_BENCH_JOBS
+#define NTICKS    CONFIG_LIB_TMGR_BENCH_TICKS
+#define MAXPERIOD CONFIG_LIB_TMGR_BENCH_MAXPERIOD
+
+static handler_t jobs[NJOBS];
+static unsigned long fired;
+
+static void bench_job(void *arg)
+{
+	(*(unsigned long *) arg)++;
+}
+
+static inline unsigned long long now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+ANTARES_APP(tmgr_bench)
+{
+	unsigned long long t, dt, min = ~0ULL, max = 0, sum = 0;
+	unsigned long hist[8] = { 0 };
+	int i, j;
+
+	srand(1);
+	for (i = 0; i < NJOBS; i++) {
+		tmgr_handler_init(&jobs[i]);
+		jobs[i].func = bench_job;
+		jobs[i].arg = &fired;
+		tmgr_register_periodic(&jobs[i], 1 + rand() % MAXPERIOD);
+	}
+
+	for (i = 0; i < NTICKS; i++) {
+		t = now_ns();
+		tmgr_tick();
+		dt = now_ns() - t;
+
+		sum += dt;
+		if (dt < min)
+			min = dt;
+		if (dt > max)
+			max = dt;
+		/* log2 buckets, starting at 64ns */
+		for (j = 0; (j < 7) && (dt >> (6 + j)); j++);;
+		hist[j]++;
+	}
+
+	printf("tmgr: %d jobs, %d ticks, %lu handlers fired\n",
+	       NJOBS, NTICKS, fired);
+	printf("tmgr: tick min %llu ns avg %llu ns max %llu ns jitter %llu ns\n",
+	       min, sum / NTICKS, max, max - min);
+	for (j = 0; j < 8; j++)
+		printf("tmgr: %s %5llu ns: %lu\n", (j == 7) ? ">=" : "< ",
+		       64ULL << ((j == 7) ? 6 : j), hist[j]);
+
+#ifdef CONFIG_LIB_TMGR_TICKLESS
+	{
+		unsigned long wakeups = 0;
+		unsigned int d, left = NTICKS;
+
+		fired = 0;
+		sum = 0;
+		max = 0;
+		while (left) {
+			d = tmgr_next_deadline();
+			if (d > left)
+				d = left;
+			t = now_ns();
+			tmgr_advance(d);
+			dt = now_ns() - t;
+			sum += dt;
+			if (dt > max)
+				max = dt;
+			wakeups++;
+			left -= d;
+		}
+		printf("tmgr: tickless: %d ticks in %lu wakeups, %lu handlers fired\n",
+		       NTICKS, wakeups, fired);
+		printf("tmgr: tickless: wakeup avg %llu ns max %llu ns\n",
+		       sum / wakeups, max);
+	}
+#endif
+	exit(0);
+}
@@ -1,10 +1,28 @@
+#include <string.h>
+#include <arch/antares.h>
 #include <lib/tasks.h>
 
+/*
+ * Hierarchical timing wheel, see Varghese & Lauck.
+ * Level 0 has one slot per tick, each next level has slots
+ * WHEEL_SIZE times coarser than the previous one. A handler lands
+ * in the level its deadline fits in and is moved (cascaded) one
+ * level down each time the lower level wraps. This gives O(1)
+ * insert, cancel and expiry no matter how many handlers are pending.
+ */
+
+#define WHEEL_BITS    CONFIG_LIB_TMGR_WHEEL_BITS
+#define WHEEL_LEVELS  CONFIG_LIB_TMGR_WHEEL_LEVELS
+#define WHEEL_SIZE    (1 << WHEEL_BITS)
+#define WHEEL_MASK    (WHEEL_SIZE - 1)
+#define UPTIME_BITS   (sizeof(unsigned int) * 8)
+
+#define LEVEL_SHIFT(lvl)    ((lvl) * WHEEL_BITS)
+#define LEVEL_INDEX(t, lvl) (((t) >> LEVEL_SHIFT(lvl)) & WHEEL_MASK)
 
 static volatile unsigned int uptime = 0;
 static volatile unsigned int rate = 0;
-static int num_handlers = 0;
-static handler_t * first = 0;
+static handler_t * wheel[WHEEL_LEVELS][WHEEL_SIZE];
 
 void tmgr_msleep(unsigned int  time)
 {
@@ -12,112 +30,241 @@ void tmgr_msleep(unsigned int  time)
   while ( uptime < end );;
 }
 
+unsigned int tmgr_get_uptime()
+{
+	return uptime;
+}
+
+static void wheel_unlink(handler_t *h)
+{
+	*h->pprev = h->next;
+	if (h->next)
+		h->next->pprev = h->pprev;
+	h->next = 0;
+	h->pprev = 0;
+}
+
+static void wheel_add(handler_t *h)
+{
+	unsigned int expires = h->uptime;
+	unsigned int delta = expires - uptime;
+	handler_t **slot;
+	int lvl = 0;
+
+	if ((int) delta < 0) {
+		/* Overdue, run it on the very next tick */
+		slot = &wheel[0][uptime & WHEEL_MASK];
+	} else {
+		while ((lvl < WHEEL_LEVELS - 1) &&
+		       (LEVEL_SHIFT(lvl + 1) < UPTIME_BITS) &&
+		       (delta >> LEVEL_SHIFT(lvl + 1)))
+			lvl++;
+		/*
+		 * Too far for the top level. Park it in the farthest slot,
+		 * it is put back where it belongs when that slot is reached
+		 */
+		if ((delta >> LEVEL_SHIFT(lvl)) > WHEEL_MASK)
+			expires = uptime + ((unsigned int) WHEEL_MASK << LEVEL_SHIFT(lvl));
+		slot = &wheel[lvl][LEVEL_INDEX(expires, lvl)];
+	}
+
+	h->next = *slot;
+	if (h->next)
+		h->next->pprev = &h->next;
+	h->pprev = slot;
+	*slot = h;
+}
+
+/* Redistribute one slot of a level among the lower levels */
+static unsigned int wheel_cascade(int lvl)
+{
+	unsigned int idx = LEVEL_INDEX(uptime, lvl);
+	handler_t *list = wheel[lvl][idx];
+	handler_t *h;
+
+	wheel[lvl][idx] = 0;
+	while (list) {
+		h = list;
+		list = h->next;
+		wheel_add(h);
+	}
+	return idx;
+}
+
+/*
+ * Scale a tick count from the old rate to the new one. The remainder
+ * times the new rate can take up to twice the width of an int
+ */
+static unsigned int rescale(unsigned int ticks, unsigned int from, unsigned int to)
+{
+	return (ticks / from) * to +
+		(unsigned int) ((unsigned long long) (ticks % from) * to / from);
+}
+
 void tmgr_set_rate(unsigned int nrate)
 {
+	handler_t *list = 0;
+	handler_t *h;
+	unsigned int left;
+	int lvl, i;
+
+	if (!rate || !nrate || (rate == nrate)) {
+		rate = nrate;
+		return;
+	}
+
+	/* Rare enough to just pull everything out of the wheel */
+	for (lvl = 0; lvl < WHEEL_LEVELS; lvl++)
+		for (i = 0; i < WHEEL_SIZE; i++)
+			while ((h = wheel[lvl][i])) {
+				wheel_unlink(h);
+				h->next = list;
+				list = h;
+			}
+
+	while (list) {
+		h = list;
+		list = h->next;
+		left = h->uptime - uptime;
+		if ((int) left > 0)
+			h->uptime = uptime + rescale(left, rate, nrate);
+		if (h->period) {
+			h->period = rescale(h->period, rate, nrate);
+			if (!h->period)
+				h->period = 1;
+		}
+		wheel_add(h);
+	}
 	rate = nrate;
-	/* TODO: Reschedule pending tasks based on new rate */
 }
 
-
-unsigned int tmgr_get_uptime()
+void tmgr_handler_init(handler_t * data)
 {
-	return uptime;
+	memset(data, 0, sizeof(*data));
 }
 
 int tmgr_register(handler_t * data)
 {
-    // 0. The most simplest case - too late to run handler
-    if(data->uptime < uptime) return TIME_OVER;
-    // 1. The simplest case - no handlers. So, let's add the first one
-    if(num_handlers == 0)
-    {
-        first = data;
-    }
-    // 2. The second case - there is only 1 handler.
-    else if(num_handlers == 1)
-    {
-        #ifdef REM_HANDLER_IF_DEFINED
-        if(first->handler == data->handler) // if this handler has been registered before
-        {
-            first->uptime = data->uptime;
-            return;
-        }
-        #endif
-        if(first->uptime > data->uptime) first->next = data;
-        else
-        {
-            data->next = first;
-            first = data;
-        }
-    }
-    // 3. There are many handlers - run sorting algorythm
-    else
-    {
-        int i = num_handlers;
-        handler_t * current = first;
-        handler_t * prev = 0;
-
-        while(i != 0)
-        {
-            #ifdef REM_HANDLER_IF_DEFINED
-            if(current->handler == data->handler) // remove this handler if registered
-            {
-                if(prev == 0) first = first->next;
-                else prev->next = current->next;
-                num_handlers--;
-            }
-            #endif
-            if(current->uptime <= data->uptime)
-            {
-                data->next = current;
-                if(prev == 0) first = data;
-                else prev->next = data;
-                i++;
-                break;
-            }
-            prev = current;
-            current = current->next;
-            i--;
-        }
-        if(i==0) prev->next = data;
-        #ifdef REM_HANDLER_IF_DEFINED
-        else
-        {
-            while(i != 0)
-            {
-                if(current->handler == data->handler)
-                {
-                    prev->next = current->next;
-                    num_handlers--;
-                    break;
-                }
-                prev = current;
-                current = current->next;
-                i--;
-            }
-        }
-        #endif
-    }
-
-    num_handlers++;
-    return 0;
+	if ((int) (data->uptime - uptime) < 0)
+		return TIME_OVER;
+	if (data->pprev)
+		wheel_unlink(data);
+	wheel_add(data);
+	return 0;
+}
+
+int tmgr_register_periodic(handler_t * data, unsigned int period)
+{
+	data->period = period;
+	data->uptime = uptime + period;
+	return tmgr_register(data);
+}
+
+void tmgr_cancel(handler_t * data)
+{
+	if (data->pprev)
+		wheel_unlink(data);
 }
 
 void tmgr_tick(void)
 {
-    int i = num_handlers;
-    handler_t * current = first;
-    while(i != 0)
-    {
-        if(current->uptime == uptime)
-        {
-            current->handler();
-        }
-        else if(current->uptime < uptime) break;
-
-        current = current->next;
-        i--;
-    }
-    num_handlers -= i;
-    uptime++;
+	unsigned int idx = uptime & WHEEL_MASK;
+	handler_t *list;
+	handler_t *h;
+	int lvl;
+
+	/* Levels past the width of uptime are never used, see wheel_add() */
+	if (!idx)
+		for (lvl = 1; lvl < WHEEL_LEVELS &&
+			     LEVEL_SHIFT(lvl) < UPTIME_BITS; lvl++)
+			if (wheel_cascade(lvl))
+				break;
+
+	/*
+	 * Detach the expired slot first, so that handlers can
+	 * safely register or cancel anything, including themselves
+	 */
+	list = wheel[0][idx];
+	wheel[0][idx] = 0;
+	if (list)
+		list->pprev = &list;
+	uptime++;
+
+	while (list) {
+		h = list;
+		wheel_unlink(h);
+		if ((int) (h->uptime - uptime) >= 0) {
+			wheel_add(h); /* parked, not due yet */
+			continue;
+		}
+		/* Rearm before running, so that the handler may cancel it */
+		if (h->period) {
+			h->uptime += h->period;
+			wheel_add(h);
+		}
+		if (h->func)
+			h->func(h->arg);
+		else
+			h->handler();
+	}
+}
+
+#ifdef CONFIG_LIB_TMGR_TICKLESS
+
+/*
+ * Every tick that runs a handler or cascades a non-empty slot is an
+ * event. Scan each level for the first non-empty slot ahead and return
+ * how many ticks pass until the earliest of those is processed.
+ * Cascades are only upper bounds of the real deadline, so at worst this
+ * costs one early wakeup per level.
+ */
+unsigned int tmgr_next_deadline(void)
+{
+	unsigned int u = uptime;
+	unsigned int best = TMGR_NO_DEADLINE;
+	unsigned int k, first, d, s;
+	int lvl;
+
+	for (lvl = 0; lvl < WHEEL_LEVELS; lvl++) {
+		s = LEVEL_SHIFT(lvl);
+		if (s >= UPTIME_BITS)
+			break;
+		/*
+		 * Once the lower levels have moved on, the current slot of
+		 * this level is already cascaded and holds the next rotation
+		 */
+		first = (u & ((1U << s) - 1)) ? 1 : 0;
+		for (k = first; k <= first + WHEEL_MASK; k++)
+			if (wheel[lvl][(LEVEL_INDEX(u, lvl) + k) & WHEEL_MASK])
+				break;
+		if (k > first + WHEEL_MASK)
+			continue;
+		if (((k << s) >> s) != k)
+			d = TMGR_NO_DEADLINE - 1; /* beyond what we can count */
+		else
+			d = (k << s) - (u & ((1U << s) - 1)) + 1;
+		if (d < best)
+			best = d;
+	}
+	return best;
 }
+
+void tmgr_advance(unsigned int ticks)
+{
+	unsigned int idle;
+
+	while (ticks) {
+		/* Ticks before the next event have nothing to do */
+		idle = tmgr_next_deadline() - 1;
+		if (idle >= ticks) {
+			uptime += ticks;
+			return;
+		}
+		uptime += idle;
+		ticks -= idle;
+		tmgr_tick();
+		ticks--;
+	}
+}
+
+#endif
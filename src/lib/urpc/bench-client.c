@@ -0,0 +1,242 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <arch/antares.h>
+#include <lib/urpc.h>
+#include <lib/urpc-client.h>
+
+/*
+ * Runs tinyrpc and the serial transport in a child process on one
+ * end of a pty and the host client on the other, then hammers a
+ * 'ping' method with pipelined calls.
+ */
+
+#define NCALLS   CONFIG_URPC_CLIENT_BENCH_CALLS
+#define WINDOW   CONFIG_URPC_CLIENT_BENCH_WINDOW
+#define BATCH    CONFIG_URPC_CLIENT_BENCH_BATCH
+#define BAUD     115200
+#define TIMEOUT  1000
+
+/* Device side */
+
+static int dev_fd;
+
+static void ping(char *data)
+{
+	urpc_respond(data, 4);
+}
+
+URPC_EXPORTS(
+	URPC_METHOD("ping", "bbbb", "bbbb", ping)
+);
+
+static void dev_write(const char *data, int len)
+{
+	int n;
+	while (len > 0) {
+		n = write(dev_fd, data, len);
+		if (n <= 0)
+			_exit(1);
+		data += n;
+		len -= n;
+	}
+}
+
+#ifdef CONFIG_URPC_TX_QUEUE
+
+/* Plays DMA: sends everything right away */
+void urpc_serial_tx_start()
+{
+	const char *p;
+	int n;
+	while ((n = urpc_serial_tx_pending(&p))) {
+		dev_write(p, n);
+		urpc_serial_tx_done(n);
+	}
+}
+
+static void dev_flush() { }
+
+#else
+
+static char dev_out[4096];
+static int dev_len;
+
+static void dev_flush()
+{
+	dev_write(dev_out, dev_len);
+	dev_len = 0;
+}
+
+/* 
+ * A UART would send it at once, we collect a loop's worth. The
+ * transport has it as void putchar(char), which is the same thing
+ * as far as the calling convention goes.
+ */
+int putchar(int c)
+{
+	if (dev_len == sizeof(dev_out))
+		dev_flush();
+	dev_out[dev_len++] = c;
+	return c;
+}
+
+#endif
+
+static void device(int fd)
+{
+	struct pollfd p = { .fd = fd, .events = POLLIN };
+	char buf[256];
+	int i, n;
+
+	dev_fd = fd;
+	for (;;) {
+		urpc_loop();
+		dev_flush();
+		if (poll(&p, 1, 1) <= 0)
+			continue;
+		n = read(fd, buf, sizeof(buf));
+		if (n <= 0)
+			_exit(0);
+		/* Like an RX ISR interrupting the loop after each byte */
+		for (i = 0; i < n; i++) {
+			gotchar(buf[i]);
+			urpc_loop();
+		}
+		dev_flush();
+	}
+}
+
+/* Host side */
+
+static unsigned long long now_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long) ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static int cmp_ull(const void *a, const void *b)
+{
+	unsigned long long x = *(const unsigned long long *) a;
+	unsigned long long y = *(const unsigned long long *) b;
+	return (x > y) - (x < y);
+}
+
+static unsigned long long *sent, *lat;
+
+static void host(int fd)
+{
+	struct urpc_client c;
+	struct urpc_reply r;
+	unsigned long long start, t;
+	unsigned long next = 0, done = 0, lost = 0, payload;
+	unsigned int seq;
+	long id;
+	int i, inflight = 0;
+	double secs, wire;
+
+	if (urpc_client_open(&c, fd, 0, TIMEOUT)) {
+		fprintf(stderr, "urpc: discovery failed\n");
+		return;
+	}
+	printf("urpc: device has %d objects, size %d bytes, id %d bytes, "
+	       "features 0x%x\n", c.nobjs, c.szb, c.idb, c.features);
+	id = urpc_client_find(&c, "ping");
+	if (id < 0)
+		return;
+	c.tx_bytes = c.rx_bytes = 0;
+
+	start = now_us();
+	while (done + lost < NCALLS) {
+		while ((inflight + BATCH <= WINDOW) && (next < NCALLS)) {
+			if (BATCH > 1)
+				urpc_client_batch_begin(&c);
+			for (i = 0; (i < BATCH) && (next < NCALLS); i++) {
+				seq = next;
+				sent[next++] = now_us();
+				urpc_client_call(&c, id, &seq, sizeof(seq));
+				inflight++;
+			}
+			if (BATCH > 1)
+				urpc_client_batch_end(&c);
+		}
+		if (urpc_client_reply(&c, &r, TIMEOUT) <= 0) {
+			/* Whatever is out there is gone */
+			lost += inflight;
+			inflight = 0;
+			continue;
+		}
+		t = now_us();
+		if (!r.has_id || (r.id != id) || (r.len != sizeof(seq)))
+			continue;
+		memcpy(&seq, r.data, sizeof(seq));
+		if (seq >= next)
+			continue;
+		lat[done++] = t - sent[seq];
+		inflight--;
+	}
+	secs = (now_us() - start) / 1e6;
+	if (!done) {
+		fprintf(stderr, "urpc: no replies\n");
+		return;
+	}
+
+	qsort(lat, done, sizeof(lat[0]), cmp_ull);
+	/* What the calls carry: argument and reply data */
+	payload = done * 2 * sizeof(seq);
+	wire = (double) (c.tx_bytes > c.rx_bytes ? c.tx_bytes : c.rx_bytes) / done;
+
+	printf("urpc: %lu calls, %d in flight, %d per packet, %lu lost\n",
+	       done, WINDOW, BATCH, lost);
+	printf("urpc: %.0f calls/sec over pty\n", done / secs);
+	printf("urpc: latency p50 %llu us p90 %llu us p99 %llu us max %llu us\n",
+		       lat[done / 2], lat[done * 9 / 10], lat[done * 99 / 100],
+		       lat[done - 1]);
+	printf("urpc: %.2f bytes sent, %.2f received per call, "
+	       "%.2f of them framing\n",
+	       (double) c.tx_bytes / done, (double) c.rx_bytes / done,
+	       (double) (c.tx_bytes + c.rx_bytes - payload) / done);
+	printf("urpc: at %d baud 8N1 that's at most %.0f calls/sec\n",
+	       BAUD, BAUD / 10 / wire);
+	urpc_client_close(&c);
+}
+
+ANTARES_APP(urpc_client_bench)
+{
+	struct termios tio;
+	int master, slave;
+	pid_t pid;
+
+	sent = malloc(NCALLS * sizeof(*sent));
+	lat = malloc(NCALLS * sizeof(*lat));
+	master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (!sent || !lat || (master < 0) || grantpt(master) || unlockpt(master))
+		exit(1);
+	slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+	if (slave < 0)
+		exit(1);
+	tcgetattr(slave, &tio);
+	cfmakeraw(&tio);
+	tcsetattr(slave, TCSANOW, &tio);
+
+	pid = fork();
+	if (!pid) {
+		close(master);
+		device(slave);
+	}
+	close(slave);
+	host(master);
+	close(master);
+	kill(pid, SIGTERM);
+	waitpid(pid, NULL, 0);
+	exit(0);
+}
@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/time.h>
+#include <arch/antares.h>
+#include <lib/urpc.h>
+
+/*
+ * A SIGALRM handler plays the receive ISR: every millisecond it
+ * hands a burst of packets to urpc_handle_incoming(). The main loop
+ * calls urpc_loop() and then pretends to be busy for a while.
+ */
+
+#define RATE      CONFIG_URPC_BENCH_RATE
+#define WORK_US   CONFIG_URPC_BENCH_WORK_US
+#define SECONDS   CONFIG_URPC_BENCH_SECONDS
+#define BATCH     CONFIG_URPC_BENCH_BATCH
+#define TICK_US   1000
+
+/*
+ * What the serial transport wraps a packet (id and data) in:
+ * '[' size ... crc16 ']', see transport-serial.c
+ */
+#define FRAMING   (1 + sizeof(urpc_size_t) + 2 + 1)
+
+static volatile unsigned long offered;
+static unsigned long handled;
+static unsigned long accum;
+
+static void bench_method(char *data)
+{
+	handled++;
+	accum += (unsigned char) data[0];
+}
+
+URPC_EXPORTS(
+	URPC_METHOD("bench", "b", "", bench_method)
+);
+
+/* Unused here, the bench feeds the queue directly */
+int urpc_tx_data(struct urpc_object* obj, char* data, int sz) { return 0; }
+int urpc_tx_object(struct urpc_object* obj) { return 0; }
+int urpc_tx_batch(char* data, int sz) { return 0; }
+
+struct bench_call {
+	urpc_id_t id;
+	char arg;
+} __attribute__((packed));
+
+static void bench_isr(int sig)
+{
+	static unsigned long credit;
+	struct {
+		urpc_id_t id;
+		struct {
+			urpc_size_t sz;
+			struct bench_call call;
+		} __attribute__((packed)) calls[BATCH];
+	} __attribute__((packed)) pck;
+	int i;
+
+	credit += RATE;
+	while (credit >= (1000000 / TICK_US) * BATCH) {
+		credit -= (1000000 / TICK_US) * BATCH;
+		if (BATCH == 1) {
+			pck.calls[0].call.id = 0;
+			pck.calls[0].call.arg = (char) offered;
+			urpc_handle_incoming((struct urpc_packet *) &pck.calls[0].call,
+					     sizeof(struct bench_call));
+			offered++;
+			continue;
+		}
+		pck.id = URPC_ID_BATCH;
+		for (i = 0; i < BATCH; i++) {
+			pck.calls[i].sz = sizeof(struct bench_call);
+			pck.calls[i].call.id = 0;
+			pck.calls[i].call.arg = (char) offered++;
+		}
+		urpc_handle_incoming((struct urpc_packet *) &pck, sizeof(pck));
+	}
+}
+
+static unsigned long long now_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long) ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+ANTARES_APP(urpc_bench)
+{
+	struct itimerval it = {
+		.it_interval = { 0, TICK_US },
+		.it_value = { 0, TICK_US },
+	};
+	struct itimerval stop;
+	unsigned long long start, t;
+	unsigned long loops = 0;
+
+	memset(&stop, 0, sizeof(stop));
+	signal(SIGALRM, bench_isr);
+	start = now_us();
+	setitimer(ITIMER_REAL, &it, NULL);
+
+	while ((now_us() - start) < SECONDS * 1000000ULL) {
+		urpc_loop();
+		loops++;
+		t = now_us();
+		while (now_us() - t < WORK_US);;
+	}
+
+	setitimer(ITIMER_REAL, &stop, NULL);
+	urpc_loop();
+
+	printf("urpc: queue %d slots, loop work %d us, %lu loops\n",
+	       CONFIG_URPC_QUEUE_LEN, WORK_US, loops);
+	printf("urpc: %d calls per packet, %.2f serial bytes per call\n",
+	       BATCH, (BATCH == 1) ?
+	       (double) (FRAMING + sizeof(struct bench_call)) :
+	       (double) (FRAMING + sizeof(urpc_id_t) + BATCH *
+			 (sizeof(urpc_size_t) + sizeof(struct bench_call))) / BATCH);
+	printf("urpc: offered %lu calls, handled %lu, lost %lu (%.2f%%), "
+	       "%u packets dropped\n", offered, handled, offered - handled,
+	       offered ? 100.0 * (offered - handled) / offered : 0.0,
+	       urpc_dropped());
+	printf("urpc: sustained %.0f calls/sec\n",
+	       handled * 1000000.0 / (now_us() - start));
+	exit(0);
+}
@@ -0,0 +1,394 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <time.h>
+#include <lib/urpc.h>
+#include <lib/urpc-client.h>
+#include <lib/crc.h>
+
+/*
+ * See transport-serial.c for the frame format. Everything the
+ * device side has in its config (size and id widths, byte order)
+ * comes from the mode tag here.
+ */
+
+#define SYNC '['
+#define STOP ']'
+
+/* We don't take frames larger than that */
+#define MAX_FRAME (1 << 20)
+
+static unsigned long get_uint(struct urpc_client* c, const unsigned char* p, int w)
+{
+	unsigned long v = 0;
+	int i;
+	for (i = 0; i < w; i++)
+		if (c->endian == 'b')
+			v = (v << 8) | p[i];
+		else
+			v |= (unsigned long) p[i] << (8 * i);
+	return v;
+}
+
+static void put_uint(struct urpc_client* c, unsigned char* p, unsigned long v, int w)
+{
+	int i;
+	for (i = 0; i < w; i++)
+		p[(c->endian == 'b') ? (w - 1 - i) : i] = (v >> (8 * i)) & 0xff;
+}
+
+static unsigned long batch_id(struct urpc_client* c)
+{
+	return (c->idb >= sizeof(unsigned long)) ?
+		~0UL : (1UL << (8 * c->idb)) - 1;
+}
+
+static int grow(unsigned char** buf, int* size, int need)
+{
+	unsigned char* n;
+	if (need <= *size)
+		return 0;
+	n = realloc(*buf, need * 2);
+	if (!n)
+		return -1;
+	*buf = n;
+	*size = need * 2;
+	return 0;
+}
+
+static long long now_ms()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int write_all(struct urpc_client* c, const unsigned char* data, int len)
+{
+	int n;
+	c->tx_bytes += len;
+	while (len) {
+		n = write(c->fd, data, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		data += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/* Reads whatever is there, waiting until the deadline for something */
+static int rx_fill(struct urpc_client* c, long long deadline)
+{
+	struct pollfd p = { .fd = c->fd, .events = POLLIN };
+	long long left = deadline - now_ms();
+	int n;
+
+	if (left < 0)
+		left = 0;
+	n = poll(&p, 1, left);
+	if (n < 0)
+		return (errno == EINTR) ? 0 : -1;
+	if (!n)
+		return 0;
+	if (grow(&c->rx, &c->rx_size, c->rx_len + 4096))
+		return -1;
+	n = read(c->fd, &c->rx[c->rx_len], 4096);
+	if (n < 0)
+		return (errno == EINTR || errno == EAGAIN) ? 0 : -1;
+	if (!n)
+		return -1;
+	c->rx_len += n;
+	c->rx_bytes += n;
+	return n;
+}
+
+static void rx_drop(struct urpc_client* c, int n)
+{
+	memmove(c->rx, &c->rx[n], c->rx_len - n);
+	c->rx_len -= n;
+}
+
+/* Size of a complete frame at the start of rx, 0 if there's none yet */
+static int rx_frame(struct urpc_client* c)
+{
+	unsigned char* p;
+	unsigned long size;
+	int body, total;
+
+	for (;;) {
+		p = memchr(c->rx, SYNC, c->rx_len);
+		if (!p) {
+			c->rx_len = 0;
+			return 0;
+		}
+		rx_drop(c, p - c->rx);
+		if (c->rx_len < 1 + c->szb)
+			return 0;
+		size = get_uint(c, &c->rx[1], c->szb);
+		if ((size < c->szb) || (size > MAX_FRAME))
+			goto bad;
+		body = size;
+		total = 1 + body + 3;
+		if (c->rx_len < total)
+			return 0;
+		if ((c->rx[total - 1] == STOP) &&
+		    (crc16_ccitt(0xffff, &c->rx[1], body) ==
+		     ((c->rx[1 + body] << 8) | c->rx[2 + body])))
+			return total;
+	bad:
+		rx_drop(c, 1);
+	}
+}
+
+/* Waits for a frame, returns its size, 0 on timeout or -1 */
+static int rx_wait(struct urpc_client* c, long long deadline)
+{
+	int n;
+	if (c->rx_used) {
+		rx_drop(c, c->rx_used);
+		c->rx_used = 0;
+	}
+	for (;;) {
+		n = rx_frame(c);
+		if (n)
+			return c->rx_used = n;
+		if (now_ms() >= deadline)
+			return 0;
+		if (rx_fill(c, deadline) < 0)
+			return -1;
+	}
+}
+
+/* [ szb idb endian features ] */
+static int rx_tag(struct urpc_client* c)
+{
+	unsigned char* t;
+	int i;
+	for (i = 0; i + 6 <= c->rx_len; i++) {
+		t = &c->rx[i];
+		if ((t[0] != SYNC) || (t[5] != STOP))
+			continue;
+		if (((t[1] != 1) && (t[1] != 2) && (t[1] != 4)) ||
+		    ((t[2] != 1) && (t[2] != 2) && (t[2] != 4)) ||
+		    ((t[3] != 'l') && (t[3] != 'b')))
+			continue;
+		c->szb = t[1];
+		c->idb = t[2];
+		c->endian = t[3];
+		c->features = t[4];
+		rx_drop(c, i + 6);
+		return 1;
+	}
+	return 0;
+}
+
+static int tx_frame(struct urpc_client* c, int has_id, unsigned long id,
+		    const void* data, int len)
+{
+	int body = c->szb + (has_id ? c->idb : 0) + len;
+	uint16_t crc;
+
+	if (grow(&c->tx, &c->tx_size, body + 4))
+		return -1;
+	c->tx[0] = SYNC;
+	put_uint(c, &c->tx[1], body, c->szb);
+	if (has_id)
+		put_uint(c, &c->tx[1 + c->szb], id, c->idb);
+	memcpy(&c->tx[1 + body - len], data, len);
+	crc = crc16_ccitt(0xffff, &c->tx[1], body);
+	c->tx[1 + body] = crc >> 8;
+	c->tx[2 + body] = crc & 0xff;
+	c->tx[3 + body] = STOP;
+	return write_all(c, c->tx, body + 4);
+}
+
+static int discover(struct urpc_client* c, int szb, int timeout_ms)
+{
+	unsigned char req[8] = { SYNC };
+	long long deadline = now_ms() + timeout_ms;
+	uint16_t crc;
+
+	memset(&req[1], 0, szb);
+	crc = crc16_ccitt(0xffff, &req[1], szb);
+	req[1 + szb] = crc >> 8;
+	req[2 + szb] = crc & 0xff;
+	req[3 + szb] = STOP;
+	if (write_all(c, req, szb + 4))
+		return -1;
+	while (!rx_tag(c))
+		if ((now_ms() >= deadline) || (rx_fill(c, deadline) < 0))
+			return -1;
+	return 0;
+}
+
+static int add_object(struct urpc_client* c, const unsigned char* f, int len)
+{
+	struct urpc_client_object* o;
+	const char* s[3];
+	const char* p = (const char*) f + c->idb + 1;
+	const char* end = (const char*) f + len;
+	int i;
+
+	if (len < c->idb + 4)
+		return -1;
+	for (i = 0; i < 3; i++) {
+		s[i] = p;
+		p = memchr(p, 0, end - p);
+		if (!p++)
+			return -1;
+	}
+	o = realloc(c->objs, (c->nobjs + 1) * sizeof(*o));
+	if (!o)
+		return -1;
+	c->objs = o;
+	o = &o[c->nobjs++];
+	o->id = get_uint(c, f, c->idb);
+	o->flags = f[c->idb];
+	o->name = strdup(s[0]);
+	o->data = strdup(s[1]);
+	o->reply = strdup(s[2]);
+	return 0;
+}
+
+int urpc_client_open(struct urpc_client* c, int fd, int szb, int timeout_ms)
+{
+	/* Widest first: a narrower device drops these cleanly */
+	static const int probe[] = { 4, 2, 1 };
+	long long deadline;
+	int i, n, found = 0;
+
+	memset(c, 0, sizeof(*c));
+	c->fd = fd;
+	for (i = 0; !found && (i < 3); i++)
+		if (!szb || (szb == probe[i]))
+			found = !discover(c, probe[i], timeout_ms);
+	if (!found || !(c->features & URPC_FEAT_CRC16))
+		return -1;
+
+	for (;;) {
+		deadline = now_ms() + timeout_ms;
+		n = rx_wait(c, deadline);
+		if (n <= 0)
+			return -1;
+		/* The one with no id ends the list */
+		if (n == c->szb + 4)
+			return 0;
+		if (add_object(c, &c->rx[1 + c->szb], n - c->szb - 4))
+			return -1;
+	}
+}
+
+void urpc_client_close(struct urpc_client* c)
+{
+	int i;
+	for (i = 0; i < c->nobjs; i++) {
+		free(c->objs[i].name);
+		free(c->objs[i].data);
+		free(c->objs[i].reply);
+	}
+	free(c->objs);
+	free(c->rx);
+	free(c->tx);
+	free(c->batch);
+	memset(c, 0, sizeof(*c));
+}
+
+long urpc_client_find(struct urpc_client* c, const char* name)
+{
+	int i;
+	for (i = 0; i < c->nobjs; i++)
+		if (!strcmp(c->objs[i].name, name))
+			return c->objs[i].id;
+	return -1;
+}
+
+void urpc_client_batch_begin(struct urpc_client* c)
+{
+	c->batching = 1;
+	c->batch_len = 0;
+}
+
+int urpc_client_batch_end(struct urpc_client* c)
+{
+	c->batching = 0;
+	if (!c->batch_len)
+		return 0;
+	return tx_frame(c, 1, batch_id(c), c->batch, c->batch_len);
+}
+
+int urpc_client_call(struct urpc_client* c, unsigned long id,
+		     const void* data, int len)
+{
+	unsigned char* p;
+	if (!c->batching)
+		return tx_frame(c, 1, id, data, len);
+	if (grow(&c->batch, &c->batch_size,
+		 c->batch_len + c->szb + c->idb + len))
+		return -1;
+	p = &c->batch[c->batch_len];
+	put_uint(c, p, c->idb + len, c->szb);
+	put_uint(c, p + c->szb, id, c->idb);
+	memcpy(p + c->szb + c->idb, data, len);
+	c->batch_len += c->szb + c->idb + len;
+	return 0;
+}
+
+/* Next call out of a batch reply */
+static int batch_next(struct urpc_client* c, struct urpc_reply* r)
+{
+	unsigned long len;
+	if (c->bleft < c->szb)
+		goto done;
+	len = get_uint(c, c->bcur, c->szb);
+	if ((len < c->idb) || (len > c->bleft - c->szb))
+		goto done; /* Malformed, forget the rest */
+	r->has_id = 1;
+	r->id = get_uint(c, c->bcur + c->szb, c->idb);
+	r->data = (const char*) c->bcur + c->szb + c->idb;
+	r->len = len - c->idb;
+	c->bcur += c->szb + len;
+	c->bleft -= c->szb + len;
+	return 1;
+done:
+	c->bleft = 0;
+	return 0;
+}
+
+int urpc_client_reply(struct urpc_client* c, struct urpc_reply* r, int timeout_ms)
+{
+	long long deadline = now_ms() + timeout_ms;
+	const unsigned char* f;
+	int n;
+
+	for (;;) {
+		if (c->bleft && batch_next(c, r))
+			return 1;
+		n = rx_wait(c, deadline);
+		if (n <= 0)
+			return n;
+		f = &c->rx[1 + c->szb];
+		n -= c->szb + 4;
+		if (!n) {
+			r->has_id = 0;
+			r->id = 0;
+			r->data = (const char*) f;
+			r->len = 0;
+			return 1;
+		}
+		if (n < c->idb)
+			continue;
+		r->has_id = 1;
+		r->id = get_uint(c, f, c->idb);
+		r->data = (const char*) f + c->idb;
+		r->len = n - c->idb;
+		if (r->id != batch_id(c))
+			return 1;
+		c->bcur = f + c->idb;
+		c->bleft = r->len;
+	}
+}
@@ -1,53 +1,180 @@
+#include <string.h>
+#include <arch/antares.h>
 #include <lib/urpc.h>
+#include <lib/circ_buf.h>
 
 #define STATE_DISCOVERY  1 
 
 
 static unsigned char state;
-static unsigned char objid;
+static urpc_id_t objid;
+static struct urpc_object *current; /* Method being run, for urpc_respond */
+
+#ifdef CONFIG_URPC_BATCH
+static unsigned char batching;
+static char reply[CONFIG_URPC_BATCH_REPLY];
+static int reply_len;
+#endif
 
-/* TODO: Optional packet queue */
 #ifndef CONFIG_URPC_ISR_CONTEXT
-static struct urpc_packet *packet;
+
+#define QUEUE_LEN CONFIG_URPC_QUEUE_LEN
+
+#if QUEUE_LEN & (QUEUE_LEN - 1)
+#error "CONFIG_URPC_QUEUE_LEN must be a power of 2"
+#endif
+
+/* 
+ * Incoming packets are copied here by the transport (usually from ISR)
+ * and processed later from urpc_loop(). Single producer, single consumer.
+ */
+struct urpc_slot {
+	urpc_size_t sz;
+	union {
+		struct urpc_packet pck;
+		char raw[CONFIG_URPC_QUEUE_SLOT];
+	} u;
+};
+
+static struct urpc_slot queue[QUEUE_LEN];
+static volatile unsigned char q_head; /* Written by urpc_handle_incoming */
+static volatile unsigned char q_tail; /* Written by urpc_loop */
+static volatile unsigned int q_dropped;
+
 #endif
 
-static void process_packet(struct urpc_packet *pck) {
-	int id = (int) pck->id;
-	if (urpc_exports[id].method)
-		urpc_exports[id].method(&pck->data);
+static void dispatch(urpc_id_t id, char *data) {
+	/* Also rejects URPC_ID_BATCH, it never fits the table */
+	if (id >= urpc_nexports || !urpc_exports[id].method)
+		return;
+	current = &urpc_exports[id];
+	current->method(data);
+	current = 0;
+}
+
+#ifdef CONFIG_URPC_BATCH
+
+static void batch_flush() {
+	if (reply_len)
+		urpc_tx_batch(reply, reply_len);
+	reply_len = 0;
+}
+
+/* Calls are not aligned inside a batch, hence the memcpy */
+static void process_batch(char *p, urpc_size_t sz) {
+	urpc_size_t len;
+	urpc_id_t id;
+	batching = 1;
+	while (sz >= sizeof(urpc_size_t)) {
+		memcpy(&len, p, sizeof(urpc_size_t));
+		p += sizeof(urpc_size_t);
+		sz -= sizeof(urpc_size_t);
+		if ((len < sizeof(urpc_id_t)) || (len > sz))
+			break; /* Malformed, drop the rest */
+		memcpy(&id, p, sizeof(urpc_id_t));
+		dispatch(id, p + sizeof(urpc_id_t));
+		p += len;
+		sz -= len;
+	}
+	batch_flush();
+	batching = 0;
+}
+
+#endif
+
+static void process_packet(struct urpc_packet *pck, urpc_size_t sz) {
+	if (sz < sizeof(urpc_id_t))
+		return;
+#ifdef CONFIG_URPC_BATCH
+	if (pck->id == URPC_ID_BATCH) {
+		process_batch((char *) &pck->data, sz - sizeof(urpc_id_t));
+		return;
+	}
+#endif
+	dispatch(pck->id, (char *) &pck->data);
+}
+
+void urpc_respond(char* data, int sz) {
+#ifdef CONFIG_URPC_BATCH
+	urpc_size_t len = sz + sizeof(urpc_id_t);
+	urpc_id_t id;
+	int need = sizeof(urpc_size_t) + len;
+	if (batching && need <= sizeof(reply)) {
+		if (reply_len + need > sizeof(reply))
+			batch_flush();
+		id = URPC_OBJ_ID(current);
+		memcpy(&reply[reply_len], &len, sizeof(urpc_size_t));
+		reply_len += sizeof(urpc_size_t);
+		memcpy(&reply[reply_len], &id, sizeof(urpc_id_t));
+		reply_len += sizeof(urpc_id_t);
+		memcpy(&reply[reply_len], data, sz);
+		reply_len += sz;
+		return;
+	}
+#endif
+	urpc_tx_data(current, data, sz);
 }
 
 void urpc_loop() {
 #ifndef CONFIG_URPC_ISR_CONTEXT
-	if (packet)
-		process_packet(packet);
+	unsigned char head = q_head;
+	unsigned char tail = q_tail;
+	/* 
+	 * Drain what we have now. Stuff that arrives meanwhile is
+	 * left for the next call, so that discovery makes progress
+	 */
+	while (tail != head) {
+		barrier();
+		process_packet(&queue[tail].u.pck, queue[tail].sz);
+		tail = CIRC_NEXT(tail, 1, QUEUE_LEN);
+		q_tail = tail;
+	}
 #endif
 	if (state == STATE_DISCOVERY) {
-		urpc_tx_object(&urpc_exports[objid++]);
-		if (!urpc_exports[objid].flags)
-		{
-			urpc_tx_data(0,0,0);
-			state=0;
+		/* 
+		 * A blocking transport sends one object per call, so that
+		 * we don't stall the loop. A queued one takes all that fit.
+		 */
+		while ((objid < urpc_nexports) &&
+		       !urpc_tx_object(&urpc_exports[objid])) {
+			objid++;
+#ifndef CONFIG_URPC_TX_QUEUE
+			break;
+#endif
 		}
+		if ((objid >= urpc_nexports) && !urpc_tx_data(0,0,0))
+			state=0;
 	}	
 }
 
-void urpc_handle_incoming(struct urpc_packet* pck) {
+void urpc_handle_incoming(struct urpc_packet* pck, urpc_size_t sz) {
 #ifdef CONFIG_URPC_ISR_CONTEXT
-	process_packet(pck);
+	process_packet(pck, sz);
 #else
-	if (!packet)
-		packet = pck;
-	/* We discard a packet if we're busy */
+	unsigned char head = q_head;
+	/* We discard a packet if the queue is full or it doesn't fit a slot */
+	if (!CIRC_SPACE(head, q_tail, QUEUE_LEN) || 
+	    (sz > sizeof(queue[0].u.raw))) {
+		q_dropped++;
+		return;
+	}
+	queue[head].sz = sz;
+	memcpy(queue[head].u.raw, pck, sz);
+	barrier();
+	q_head = CIRC_NEXT(head, 1, QUEUE_LEN);
+#endif
+}
+
+unsigned int urpc_dropped() {
+#ifdef CONFIG_URPC_ISR_CONTEXT
+	return 0;
+#else
+	return q_dropped;
 #endif
 }
 
 void urpc_discovery() {
-	struct urpc_object *obj;
-	obj = &urpc_exports[0];
 	state = STATE_DISCOVERY;
 	objid=0;
 
 }
-
-
@@ -1,130 +1,367 @@
-/* 
- * Very simple and limited urpc transport
- * over conventional serial. Relies on:
- * sizeof(urpc_id_t)   == 1
- * sizeof(urpc_size_t) == 1
- * Making it support for different lengths would
- * increase code size, so let it be.
- * Packet with empty payload triggers discovery
- * You need to supply a 'putchar' and call 'gotchar'
- * Whenever a byte is received
+/*
+ * urpc transport over conventional serial, or any other byte
+ * stream. Frames look like this:
+ * [ size | id | data | crc ]
+ * 'size' is a urpc_size_t and counts itself, 'id' and 'data'.
+ * 'id' is a urpc_id_t. Both go in the byte order of the mode tag.
+ * 'crc' is CRC16-CCITT (0x1021, init 0xffff) of everything between
+ * the brackets except itself, most significant byte first.
+ * A frame with size 0 and no id triggers discovery.
  *
+ * You need to supply a 'putchar' and call 'gotchar' whenever a
+ * byte is received, or 'gotdata' when you have a bunch of them.
+ * Packets that fit CONFIG_URPC_SERIAL_BUF are passed on to
+ * urpc_handle_incoming(). Calls to objects that have a stream
+ * callback go there instead, straight from the buffer passed to
+ * gotdata(), up to CONFIG_URPC_SERIAL_STREAM_MAX bytes. Anything
+ * larger is taken for garbage, like a corrupted size would be, and
+ * the receiver looks for the next frame.
+ *
+ * With CONFIG_URPC_TX_QUEUE frames are not sent with 'putchar' but
+ * put into a ring buffer. Provide 'urpc_serial_tx_start', which
+ * enables the TX empty interrupt or starts DMA if they are idle.
+ * They then take the data with urpc_serial_tx_getchar() or
+ * urpc_serial_tx_pending()/urpc_serial_tx_done().
  */
 
+#include <stdint.h>
 #include <string.h>
+#include <arch/antares.h>
 #include <lib/urpc.h>
+#include <lib/circ_buf.h>
+#include <lib/crc.h>
 
 #define SYNC '['
 #define STOP ']'
-#define ACK  'A'
-#define NACK 'N'
 
-static unsigned char buf[16];
-static int ptr=0;
-static char state=0;
-static char sz=0;
-static unsigned char csum;
+#define CRC_INIT 0xffff
 
-void putchar(char data);
-static void putdata(const char* data, int len);
+enum {
+	ST_SYNC = 0,
+	ST_SIZE,
+	ST_ID,
+	ST_DATA,
+	ST_CRC,
+	ST_STOP
+};
+
+static union {
+	struct urpc_packet pck;
+	char raw[CONFIG_URPC_SERIAL_BUF];
+} rx;
+
+static unsigned char state;
+static unsigned char hptr;       /* Bytes of the current header field so far */
+static urpc_size_t rx_size;      /* As received */
+static urpc_size_t rx_left;      /* Data bytes still to come */
+static urpc_size_t rx_len;       /* Bytes in rx.raw */
+static struct urpc_object* rx_stream;
+static uint16_t rx_crc;
+static uint16_t rx_sent_crc;
+
+static uint16_t tx_crc;
+
+#ifdef CONFIG_URPC_TX_QUEUE
+
+#define TXQ_SIZE CONFIG_URPC_TX_QUEUE_SIZE
+
+#if TXQ_SIZE & (TXQ_SIZE - 1)
+#error "CONFIG_URPC_TX_QUEUE_SIZE must be a power of 2"
+#endif
+
+static char txq[TXQ_SIZE];
+static volatile unsigned int txq_head; /* Moved by urpc_loop() context */
+static volatile unsigned int txq_tail; /* Moved by the ISR */
+static unsigned char tag_pending;
 
-static void csum_add(unsigned char* data, int len) 
+void urpc_serial_tx_start();
+
+/*
+ * Normally tx_begin() has checked there's room for the whole frame.
+ * Frames larger than the ring have to wait for the ISR to drain it.
+ */
+static void tx_write(const char* data, int len)
 {
-	while (len--) {
-		csum+=data[len];
+	unsigned int head = txq_head;
+	int n;
+	while (len) {
+		n = CIRC_SPACE_TO_END(head, txq_tail, TXQ_SIZE);
+		if (!n) {
+			urpc_serial_tx_start();
+			continue;
+		}
+		if (n > len)
+			n = len;
+		memcpy(&txq[head], data, n);
+		head = CIRC_NEXT(head, n, TXQ_SIZE);
+		data += n;
+		len -= n;
+		barrier();
+		txq_head = head;
 	}
 }
 
+int urpc_serial_tx_getchar()
+{
+	unsigned int tail = txq_tail;
+	int c;
+	if (tail == txq_head)
+		return -1;
+	c = (unsigned char) txq[tail];
+	txq_tail = CIRC_NEXT(tail, 1, TXQ_SIZE);
+	return c;
+}
+
+int urpc_serial_tx_pending(const char** data)
+{
+	unsigned int head = txq_head;
+	unsigned int tail = txq_tail;
+	*data = &txq[tail];
+	return CIRC_CNT_TO_END(head, tail, TXQ_SIZE);
+}
+
+void urpc_serial_tx_done(int n)
+{
+	txq_tail = CIRC_NEXT(txq_tail, n, TXQ_SIZE);
+}
 
-static const char mode[] = URPC_MODE_TAG;
+#else
 
+void putchar(char data);
 
-void serialdiscovery() 
+static void tx_write(const char* data, int len)
 {
-	putchar(SYNC);
-	putdata(mode, 4);
-	putchar(STOP);
+	while (len--)
+		putchar(*data++);
 }
 
-void gotchar(char b) 
+#endif
+
+static void tx_char(char c)
 {
-	switch (state) {
-	case 0:
-		if (b==SYNC) state=1;
-		ptr=0;
-		break;
-	case 1:
-		buf[ptr++]=b;
-		if (ptr == buf[0]+1) {
-			state=0;
-			csum=0;
-			csum_add(buf,buf[0]);
-			if (csum==buf[buf[0]]) {
-				if (buf[0]==0) {
-					serialdiscovery();
-					urpc_discovery(); 
-				} else
-					urpc_handle_incoming((struct urpc_packet*)&buf[1]); 
-			}
-				
+	tx_write(&c, 1);
+}
+
+static const char mode[] = {
+	STAG, ITAG, ENDIANNESS, URPC_FEAT_BATCH | URPC_FEAT_CRC16
+};
+
+static void tx_mode_tag()
+{
+	tx_char(SYNC);
+	tx_write(mode, sizeof(mode));
+	tx_char(STOP);
+}
+
+#ifdef CONFIG_URPC_TX_QUEUE
+/* The ring has a single producer, send it with the first object */
+#define TAG_SIZE (sizeof(mode) + 2)
+#define serialdiscovery() (tag_pending = 1)
+#else
+#define serialdiscovery() tx_mode_tag()
+#endif
+
+static void rx_header_done()
+{
+	urpc_id_t id = rx.pck.id;
+	rx_left = rx_size - sizeof(urpc_size_t) - sizeof(urpc_id_t);
+	rx_len = sizeof(urpc_id_t);
+	rx_stream = 0;
+	/*
+	 * Don't eat a declared length we can't take: one bad size byte
+	 * would keep the link dead for as long. Look for the next '['
+	 * instead, the CRC throws out whatever false frame that finds.
+	 */
+	if ((id < urpc_nexports) && urpc_exports[id].stream) {
+		if (rx_left > CONFIG_URPC_SERIAL_STREAM_MAX) {
+			state = ST_SYNC;
+			return;
 		}
+		rx_stream = &urpc_exports[id];
+		rx_stream->stream(URPC_STREAM_BEGIN, 0, rx_left);
+	} else if (rx_left > sizeof(rx.raw) - rx_len) {
+		state = ST_SYNC;
+		return;
 	}
+	state = rx_left ? ST_DATA : ST_CRC;
 }
 
-static void putdata(const char* data, int len) 
+static void rx_frame_done(unsigned char b)
 {
-	while (len--) {
-		putchar(*data);
-		csum+=*data++;
+	int ok = (b == STOP) && (rx_crc == rx_sent_crc);
+	if (rx_stream) {
+		rx_stream->stream(ok ? URPC_STREAM_END : URPC_STREAM_ABORT, 0, 0);
+		rx_stream = 0;
+	} else if (ok && !rx_size) {
+		serialdiscovery();
+		urpc_discovery();
+	} else if (ok) {
+		urpc_handle_incoming(&rx.pck, rx_len);
 	}
 }
 
-static void putstr(const char* data) {
-	while (*data) {
-		putchar(*data);
-                csum+=*data++;
+static void rx_byte(unsigned char b)
+{
+	switch (state) {
+	case ST_SYNC:
+		if (b == SYNC) {
+			state = ST_SIZE;
+			hptr = 0;
+			rx_crc = CRC_INIT;
+		}
+		break;
+	case ST_SIZE:
+		((unsigned char*) &rx_size)[hptr++] = b;
+		rx_crc = crc16_ccitt_byte(rx_crc, b);
+		if (hptr < sizeof(urpc_size_t))
+			break;
+		hptr = 0;
+		if (!rx_size)
+			state = ST_CRC;
+		else if (rx_size < sizeof(urpc_size_t) + sizeof(urpc_id_t))
+			state = ST_SYNC; /* Garbage */
+		else
+			state = ST_ID;
+		break;
+	case ST_ID:
+		rx.raw[hptr++] = b;
+		rx_crc = crc16_ccitt_byte(rx_crc, b);
+		if (hptr < sizeof(urpc_id_t))
+			break;
+		hptr = 0;
+		rx_header_done();
+		break;
+	case ST_CRC:
+		rx_sent_crc = (rx_sent_crc << 8) | b;
+		if (++hptr == 2)
+			state = ST_STOP;
+		break;
+	case ST_STOP:
+		state = ST_SYNC;
+		rx_frame_done(b);
+		break;
+	}
+}
+
+void gotdata(const char* data, int len)
+{
+	urpc_size_t n;
+	while (len) {
+		if (state != ST_DATA) {
+			rx_byte(*data++);
+			len--;
+			continue;
+		}
+		/* Payload goes through in one piece, as much as we have */
+		n = rx_left;
+		if (n > len)
+			n = len;
+		rx_crc = crc16_ccitt(rx_crc, data, n);
+		if (rx_stream)
+			rx_stream->stream(URPC_STREAM_DATA, data, n);
+		else
+			memcpy(&rx.raw[rx_len], data, n);
+		rx_len += n;
+		rx_left -= n;
+		data += n;
+		len -= n;
+		if (!rx_left) {
+			state = ST_CRC;
+			hptr = 0;
+		}
 	}
-	putchar(0x0);
 }
 
+void gotchar(char b)
+{
+	gotdata(&b, 1);
+}
 
-void urpc_tx_data(struct urpc_object* obj, char* data, int sz) 
+static void putdata(const void* data, int len)
 {
-	urpc_id_t id;
-	urpc_size_t len=0;
-	csum=0;
-	putchar(SYNC);
+	tx_write(data, len);
+	tx_crc = crc16_ccitt(tx_crc, data, len);
+}
+
+static int tx_begin(int has_id, urpc_id_t id, int sz)
+{
+	urpc_size_t len;
 	len = (urpc_size_t) sz + sizeof(urpc_size_t);
-	if (obj) {
-		id = URPC_OBJ_ID(obj);
-		len+=sizeof(urpc_id_t);
+	if (has_id)
+		len += sizeof(urpc_id_t);
+#ifdef CONFIG_URPC_TX_QUEUE
+	{
+		/* [ len | crc ] */
+		int need = len + 4 + (tag_pending ? TAG_SIZE : 0);
+		if ((need < TXQ_SIZE) &&
+		    (need > CIRC_SPACE(txq_head, txq_tail, TXQ_SIZE)))
+			return -1;
+		if (tag_pending)
+			tx_mode_tag();
+		tag_pending = 0;
 	}
-	putdata(&len,sizeof(urpc_size_t));
-	if (obj)
-		putdata(&id,sizeof(urpc_id_t));
-	putdata(data,sz);
-	putchar(csum);
-	putchar(STOP);
+#endif
+	tx_crc = CRC_INIT;
+	tx_char(SYNC);
+	putdata(&len, sizeof(urpc_size_t));
+	if (has_id)
+		putdata(&id, sizeof(urpc_id_t));
+	return 0;
 }
 
-/* [ len | id | flags | name | data | reply | csum ] */
-void urpc_tx_object(struct urpc_object* obj) 
+int urpc_tx_stream_begin(struct urpc_object* obj, int sz)
 {
-	urpc_id_t id;
-	urpc_size_t len;
+	return tx_begin(obj != 0, obj ? URPC_OBJ_ID(obj) : 0, sz);
+}
+
+void urpc_tx_stream(const char* data, int sz)
+{
+	putdata(data, sz);
+}
+
+void urpc_tx_stream_end()
+{
+	char tail[3] = { tx_crc >> 8, tx_crc & 0xff, STOP };
+	tx_write(tail, sizeof(tail));
+#ifdef CONFIG_URPC_TX_QUEUE
+	urpc_serial_tx_start();
+#endif
+}
+
+int urpc_tx_data(struct urpc_object* obj, char* data, int sz)
+{
+	if (urpc_tx_stream_begin(obj, sz))
+		return -1;
+	putdata(data, sz);
+	urpc_tx_stream_end();
+	return 0;
+}
+
+int urpc_tx_batch(char* data, int sz)
+{
+	if (tx_begin(1, URPC_ID_BATCH, sz))
+		return -1;
+	putdata(data, sz);
+	urpc_tx_stream_end();
+	return 0;
+}
+
+static void putstr(const char* data)
+{
+	putdata(data, strlen(data) + 1);
+}
+
+/* [ size | id | flags | name | data | reply | crc ] */
+int urpc_tx_object(struct urpc_object* obj)
+{
+	int len;
 	len = strlen(obj->name) + strlen(obj->data) + strlen(obj->reply) + 4;
-	len += sizeof(urpc_id_t);
-	len += sizeof(urpc_size_t);
-	csum=0;
-	putchar(SYNC);
-	putdata(&len,sizeof(urpc_size_t));
-	id = URPC_OBJ_ID(obj);
-	putdata(&id,sizeof(urpc_id_t));
-	putchar(obj->flags);
-	csum+=obj->flags;
+	if (urpc_tx_stream_begin(obj, len))
+		return -1;
+	putdata(&obj->flags, 1);
 	putstr(obj->name);
 	putstr(obj->data);
 	putstr(obj->reply);
-	putchar(csum);
-	putchar(STOP);
+	urpc_tx_stream_end();
+	return 0;
 }
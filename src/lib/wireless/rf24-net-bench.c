@@ -0,0 +1,215 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arch/antares.h>
+#include <arch/delay.h>
+#include <lib/RF24.h>
+#include <lib/rf24-sim.h>
+#include <lib/rf24-net.h>
+
+/*
+ * Runs rf24-net on the simulated radios: a hub and some leaves,
+ * stop-and-wait against the full window, leaves sending at once,
+ * leaf to leaf through the hub, a leaf that restarts, and all of it
+ * with loss. Checks every message arrived whole and once, and prints
+ * goodput on the simulator's clock.
+ */
+
+#define LEAVES  CONFIG_LIB_RF24_NET_BENCH_LEAVES
+#define M       CONFIG_LIB_RF24_NET_BENCH_MESSAGES
+#define SIZE    RF24_NET_MTU
+#define LOSS    CONFIG_LIB_RF24_NET_BENCH_LOSS
+
+#if RF24_NET_PEERS < LEAVES
+#error "The hub needs a peer per leaf"
+#endif
+
+static const uint8_t net[4] = { 0xc2, 0xc2, 0xc2, 0xc2 };
+
+static struct rf24_net node[1 + LEAVES];
+static uint8_t msg[1 + LEAVES][SIZE];
+static unsigned int queued[1 + LEAVES], ok[1 + LEAVES];
+static unsigned int seen[1 + LEAVES][1 + LEAVES];
+static unsigned long delivered, corrupt, dups;
+static int errors;
+
+/* A message: who sent it, its number, and a pattern to check */
+static void fill(uint8_t *p, int src, unsigned int seq)
+{
+	int i;
+	p[0] = src;
+	p[1] = seq;
+	p[2] = seq >> 8;
+	for (i = 3; i < SIZE; i++)
+		p[i] = seq * 7 + src + i;
+}
+
+static void recv(struct rf24_net *n, uint8_t src, const void *m, int len)
+{
+	const uint8_t *p = m;
+	uint8_t want[SIZE];
+	unsigned int seq;
+
+	/* Only there to use up a sequence number */
+	if (!len)
+		return;
+	seq = p[1] | p[2] << 8;
+	if (len != SIZE || src > LEAVES || p[0] != src) {
+		corrupt++;
+		return;
+	}
+	fill(want, src, seq);
+	if (memcmp(p, want, SIZE))
+		corrupt++;
+	else if (seq < seen[n - node][src])
+		dups++;
+	else {
+		/* Ones in between may have been given up on */
+		seen[n - node][src] = seq + 1;
+		delivered++;
+	}
+}
+
+static void sent(struct rf24_net *n, int success)
+{
+	if (success)
+		ok[n - node]++;
+}
+
+/* Nothing to do here, the main loop polls them all */
+static void wake(struct rf24 *r)
+{
+}
+
+/* Node i from scratch, as after a reset */
+static void start(int i, int window)
+{
+	struct rf24 *r = &node[i].radio;
+
+	memset(&node[i], 0, sizeof(node[i]));
+	rf24_sim_attach(i, r, wake);
+	rf24_init(r);
+	rf24_set_data_rate(r, RF24_2MBPS);
+	node[i].recv = recv;
+	node[i].sent = sent;
+	rf24_net_init(&node[i], net, i);
+	node[i].window = window;
+}
+
+static void setup(int window)
+{
+	int i;
+
+	for (i = 0; i <= LEAVES; i++)
+		start(i, window);
+}
+
+/* Senders from..to, each M messages to 'dst', on the nodes as they are */
+static void transfer(const char *what, int from, int to, int dst)
+{
+	unsigned long long ns0, limit = 600ULL * 1000000000ULL;
+	unsigned long frames = 0, polls = 0, resends = 0, dropped = 0, want = 0;
+	unsigned long acked = 0;
+	double t;
+	int i, busy;
+
+	memset(queued, 0, sizeof(queued));
+	memset(ok, 0, sizeof(ok));
+	memset(seen, 0, sizeof(seen));
+	delivered = corrupt = dups = 0;
+	ns0 = rf24_sim_air.now;
+	do {
+		busy = 0;
+		for (i = 0; i <= LEAVES; i++)
+			rf24_net_poll(&node[i]);
+		for (i = from; i <= to; i++) {
+			if (!rf24_net_busy(&node[i]) && queued[i] < M) {
+				fill(msg[i], i, queued[i]);
+				if (!rf24_net_send(&node[i], dst, msg[i], SIZE))
+					queued[i]++;
+			}
+			busy |= queued[i] < M || rf24_net_busy(&node[i]);
+		}
+		/* Whatever the hub still has to pass on */
+		busy |= node[RF24_NET_HUB].tx.active;
+		rf24_sim_sleep(100000);
+	} while (busy && rf24_sim_air.now - ns0 < limit);
+
+	t = (rf24_sim_air.now - ns0) / 1e9;
+	for (i = 0; i <= LEAVES; i++) {
+		frames += node[i].stats.frames;
+		polls += node[i].stats.polls;
+		resends += node[i].stats.resends;
+		dropped += node[i].stats.dropped;
+		rf24_stop_listening(&node[i].radio);
+		rf24_power_down(&node[i].radio);
+	}
+	for (i = from; i <= to; i++) {
+		want += M;
+		acked += ok[i];
+	}
+
+	printf("%-30s %8.1f ms %6.0f kbit/s %6lu frames %5lu polls "
+	       "%4lu resends %3lu dropped %5lu/%lu delivered\n",
+	       what, t * 1e3, delivered * SIZE * 8 / t / 1e3, frames, polls,
+	       resends, dropped, delivered, want);
+
+	/*
+	 * Given up on is fine with loss, arriving twice or broken never
+	 * is, and neither is being told it arrived when it didn't
+	 */
+	if (busy || corrupt || dups ||
+	    (!rf24_sim_air.loss && (delivered != want || acked != want))) {
+		printf("%-30s %s, %lu corrupt, %lu twice or late: FAILED\n",
+		       what, busy ? "stuck" : "done", corrupt, dups);
+		errors++;
+	}
+}
+
+static void run(const char *what, int from, int to, int dst, int window)
+{
+	setup(window);
+	transfer(what, from, to, dst);
+}
+
+/*
+ * Leaf 1 starts over while the hub expects the sequence number just
+ * past its first one: what it sends then isn't one the hub has had.
+ */
+static void restarted(const char *what)
+{
+	int i;
+
+	setup(RF24_NET_WINDOW);
+	/* Empty, it takes one sequence number */
+	rf24_net_send(&node[1], RF24_NET_HUB, msg[1], 0);
+	do {
+		for (i = 0; i <= LEAVES; i++)
+			rf24_net_poll(&node[i]);
+		rf24_sim_sleep(100000);
+	} while (rf24_net_busy(&node[1]));
+	start(1, RF24_NET_WINDOW);
+	transfer(what, 1, 1, RF24_NET_HUB);
+}
+
+ANTARES_APP(rf24_net_bench)
+{
+	printf("rf24-net-bench: %d messages of %d bytes per sender, window %d, "
+	       "2 Mbps\n", M, SIZE, RF24_NET_WINDOW);
+
+	run("leaf to hub, stop-and-wait", 1, 1, RF24_NET_HUB, 1);
+	run("leaf to hub", 1, 1, RF24_NET_HUB, RF24_NET_WINDOW);
+	run("hub to leaf", 0, 0, 1, RF24_NET_WINDOW);
+	run("all leaves to hub", 1, LEAVES, RF24_NET_HUB, RF24_NET_WINDOW);
+	run("leaf to leaf", 1, 1, 2, RF24_NET_WINDOW);
+	restarted("leaf restarted, to hub");
+
+	rf24_sim_air.loss = LOSS;
+	run("leaf to hub, lossy, s-a-w", 1, 1, RF24_NET_HUB, 1);
+	run("leaf to hub, lossy", 1, 1, RF24_NET_HUB, RF24_NET_WINDOW);
+	run("all leaves to hub, lossy", 1, LEAVES, RF24_NET_HUB, RF24_NET_WINDOW);
+	run("leaf to leaf, lossy", 1, 1, 2, RF24_NET_WINDOW);
+
+	printf("rf24-net-bench: %s\n", errors ? "FAILED" : "all good");
+	exit(errors ? 1 : 0);
+}
@@ -0,0 +1,472 @@
+#include <stddef.h>
+#include <string.h>
+#include <arch/antares.h>
+#include <generic/macros.h>
+#include <lib/RF24.h>
+#include <lib/nRF24L01.h>
+#include <lib/rf24-net.h>
+
+#if RF24_RXQ_PIPES < 6
+#error "rf24-net needs receive queues on all six pipes"
+#endif
+
+/* Fragment header */
+#define F_SRC         0
+#define F_DST         1
+#define F_SEQ         2
+#define F_FLAGS       3
+
+#define FIRST         (1<<7)
+#define LAST          (1<<6)
+#define POLL          (1<<5)         /* No data, just fetching the ack */
+
+/* Fifth address byte of the hub's pipes 1 to 5, leaves use their id */
+#define HUB_PIPE_ADDR 0xf0
+
+/* Polls with no news before going back, times back before giving up */
+#define POLLS         3
+#define TRIES         8
+
+/* Frames on other pipes before dropping ack payloads nobody takes */
+#define ACK_IDLE      3
+
+/* The address 'from' sends to, to reach 'to' */
+static void address(struct rf24_net *n, uint8_t to, uint8_t from, uint8_t *a)
+{
+	a[0] = to == RF24_NET_HUB ? HUB_PIPE_ADDR + 1 + (from - 1) % 5 : to;
+	memcpy(&a[1], n->net, 4);
+}
+
+static int bits(uint8_t v)
+{
+	int n = 0;
+	for (; v; v &= v - 1)
+		n++;
+	return n;
+}
+
+/*
+ * Find a peer, or make room for it: a free slot, or the one heard
+ * from longest ago that has nothing going on. NULL if there's none.
+ */
+static struct rf24_net_peer *peer(struct rf24_net *n, uint8_t id)
+{
+	struct rf24_net_peer *p, *old = NULL;
+
+	for (p = n->peer; p < n->peer + RF24_NET_PEERS; p++)
+		if (p->id == id)
+			return p;
+	for (p = n->peer; p < n->peer + RF24_NET_PEERS; p++) {
+		if (p->id == 0xff) {
+			old = p;
+			break;
+		}
+		if (p->open || p->ready || (n->tx.active && p->id == n->tx.to))
+			continue;
+		if (!old || p->heard < old->heard)
+			old = p;
+	}
+	if (old) {
+		memset(old, 0, offsetof(struct rf24_net_peer, buf));
+		old->id = id;
+	}
+	return old;
+}
+
+/* A fragment on 'pipe', we're listening */
+static void rx_frame(struct rf24_net *n, uint8_t pipe, const uint8_t *f, int len)
+{
+	uint8_t link = n->id == RF24_NET_HUB ? f[F_SRC] : RF24_NET_HUB;
+	uint8_t flags = f[F_FLAGS];
+	int dlen = len - RF24_NET_HDR;
+	struct rf24_net_peer *p;
+
+	if (dlen < 0)
+		return;
+	/* No room to keep track of it, it'll give up */
+	p = peer(n, link);
+	if (!p)
+		return;
+	p->pipe = pipe;
+	p->heard = ++n->clock;
+	n->ack_dirty |= 1 << pipe;
+	if (flags & POLL)
+		return;
+
+	if (f[F_SEQ] != p->expect) {
+		/* The start of a message, unless it's one we've had again */
+		if (!(flags & FIRST) ||
+		    (uint8_t) (p->expect - f[F_SEQ]) <= RF24_NET_WINDOW)
+			return;
+		p->expect = f[F_SEQ];
+		p->open = 0;
+	}
+	/* Not until the last one has been passed on */
+	if (p->ready)
+		return;
+
+	p->expect++;
+	if (flags & FIRST) {
+		p->open = 1;
+		p->len = 0;
+		p->src = f[F_SRC];
+		p->dst = f[F_DST];
+	}
+	if (!p->open)
+		return;
+	if (p->len + dlen > RF24_NET_MTU) {
+		p->open = 0;
+		n->stats.dropped++;
+		return;
+	}
+	memcpy(&p->buf[p->len], &f[RF24_NET_HDR], dlen);
+	p->len += dlen;
+	if (!(flags & LAST))
+		return;
+
+	p->open = 0;
+	if (p->dst == n->id) {
+		n->stats.received++;
+		if (n->recv)
+			n->recv(n, p->src, p->buf, p->len);
+	} else if (n->id == RF24_NET_HUB && p->dst <= RF24_NET_MAX_ID) {
+		p->ready = 1;
+	} else {
+		n->stats.dropped++;
+	}
+}
+
+/*
+ * Queue the ack payload for 'pipe': how far everybody talking on it
+ * has got. It goes out with the ack of the next packet on the pipe.
+ * The chip holds three. When they're taken, wait for one to go out,
+ * unless frames keep coming in on other pipes and none does: then
+ * those are for senders that are done, drop them. Returns 0 if it
+ * has to wait.
+ */
+static int ack_load(struct rf24_net *n, uint8_t pipe)
+{
+	struct rf24_net_peer *p;
+	uint8_t a[32];
+	int len = 0;
+
+	for (p = n->peer; p < n->peer + RF24_NET_PEERS && len < 31; p++)
+		if (p->id != 0xff && p->pipe == pipe) {
+			a[len++] = p->id;
+			a[len++] = p->expect;
+		}
+	if (!len)
+		return 1;
+	if (bits(n->ack_loaded) == 3) {
+		if (n->ack_idle < ACK_IDLE)
+			return 0;
+		rf24_flush_tx(&n->radio);
+		n->ack_loaded = 0;
+	}
+	rf24_write_ack_payload(&n->radio, pipe, a, len);
+	n->ack_loaded |= 1 << pipe;
+	n->ack_idle = 0;
+	return 1;
+}
+
+static void rx_poll(struct rf24_net *n)
+{
+	uint8_t f[32], pipe, turn = n->ack_turn;
+	int len, i;
+
+	for (pipe = 1; pipe < 6; pipe++)
+		while ((len = rf24_recv(&n->radio, pipe, f, sizeof(f))) >= 0) {
+			/* This one took the ack payload queued for the pipe */
+			if (n->ack_loaded & (1 << pipe))
+				n->ack_idle = 0;
+			else if (n->ack_idle < 0xff)
+				n->ack_idle++;
+			n->ack_loaded &= ~(1 << pipe);
+			rx_frame(n, pipe, f, len);
+		}
+	/* Round robin, or the pipes that got theirs first hog the chip */
+	for (i = 0; i < 5; i++) {
+		pipe = 1 + (turn + i) % 5;
+		if ((n->ack_dirty & (1 << pipe)) && ack_load(n, pipe)) {
+			n->ack_dirty &= ~(1 << pipe);
+			n->ack_turn = pipe % 5;
+		}
+	}
+}
+
+/* rf24_irq() reporting on a fragment. The radio comes first in struct rf24_net */
+static void tx_done(struct rf24 *r, int ok)
+{
+	if (!ok)
+		((struct rf24_net *) r)->tx.failed = 1;
+}
+
+static int tx_start(struct rf24_net *n, uint8_t to, uint8_t src, uint8_t dst,
+		    const uint8_t *msg, int len)
+{
+	struct rf24_net_peer *p = peer(n, to);
+	uint8_t a[32];
+
+	if (!p)
+		return -1;
+	p->heard = ++n->clock;
+
+	n->tx.msg = msg;
+	n->tx.len = len;
+	n->tx.to = to;
+	n->tx.src = src;
+	n->tx.dst = dst;
+	n->tx.link = p;
+	n->tx.nfrag = len ? (len + RF24_NET_FRAG - 1) / RF24_NET_FRAG : 1;
+	n->tx.base = p->tx_seq;
+	p->tx_seq += n->tx.nfrag;
+	/*
+	 * New to the link, or the last one failed: we may have started
+	 * over, or it has. Ask where it is before sending anything, and
+	 * don't take an ack payload from before that for an answer.
+	 */
+	n->tx.sync = !p->synced;
+	if (n->tx.sync)
+		while (rf24_recv(&n->radio, 0, a, sizeof(a)) >= 0);
+	n->tx.next = n->tx.acked = n->tx.top = 0;
+	n->tx.failed = n->tx.polls = n->tx.tries = 0;
+	n->tx.active = 1;
+
+	/* Anything that comes in from here on is lost, the senders go back */
+	rf24_stop_listening(&n->radio);
+	n->ack_loaded = n->ack_idle = 0;
+	address(n, to, n->id, a);
+	rf24_open_writing_pipe(&n->radio, a);
+	return 0;
+}
+
+static void tx_finish(struct rf24_net *n, int ok)
+{
+	struct rf24_net_peer *fwd = n->tx.fwd;
+
+	n->tx.active = 0;
+	n->tx.fwd = NULL;
+	rf24_start_listening(&n->radio);
+	if (!ok) {
+		n->tx.link->synced = 0;
+		n->stats.dropped++;
+	}
+	if (fwd) {
+		fwd->ready = 0;
+		if (ok)
+			n->stats.forwarded++;
+	} else if (n->sent) {
+		n->sent(n, ok);
+	}
+}
+
+static int tx_frame(struct rf24_net *n, uint8_t i)
+{
+	uint8_t f[32];
+	int off = i * RF24_NET_FRAG;
+	int len = min_t(int, n->tx.len - off, RF24_NET_FRAG);
+
+	f[F_SRC] = n->tx.src;
+	f[F_DST] = n->tx.dst;
+	f[F_SEQ] = n->tx.base + i;
+	f[F_FLAGS] = (i == 0 ? FIRST : 0) | (i == n->tx.nfrag - 1 ? LAST : 0);
+	memcpy(&f[RF24_NET_HDR], n->tx.msg + off, len);
+	return rf24_send(&n->radio, f, RF24_NET_HDR + len);
+}
+
+/* Resend from the first fragment that hasn't arrived */
+static void tx_go_back(struct rf24_net *n)
+{
+	n->tx.next = n->tx.acked;
+	n->tx.polls = 0;
+	n->stats.resends++;
+	if (++n->tx.tries > TRIES)
+		tx_finish(n, 0);
+}
+
+/* Ack payloads that came back, ours is the entry with our id */
+static void tx_acks(struct rf24_net *n)
+{
+	struct rf24_net_peer *p = n->tx.link;
+	uint8_t a[32], d;
+	int len, i;
+
+	while ((len = rf24_recv(&n->radio, 0, a, sizeof(a))) >= 0)
+		for (i = 0; i + 1 < len; i += 2) {
+			if (a[i] != n->id)
+				continue;
+			if (n->tx.sync) {
+				/* Go on from where it is */
+				n->tx.base = a[i + 1];
+				p->tx_seq = n->tx.base + n->tx.nfrag;
+				p->synced = 1;
+				n->tx.sync = 0;
+				n->tx.polls = n->tx.tries = 0;
+				continue;
+			}
+			/* Only for what's been sent, or it's from before */
+			d = a[i + 1] - n->tx.base;
+			if (d > n->tx.acked && d <= n->tx.top) {
+				n->tx.acked = d;
+				n->tx.polls = n->tx.tries = 0;
+			}
+		}
+}
+
+static void tx_poll(struct rf24_net *n)
+{
+	struct rf24 *r = &n->radio;
+	uint8_t f[RF24_NET_HDR];
+	int sent = 0;
+
+	tx_acks(n);
+	if (n->tx.acked == n->tx.nfrag) {
+		if (!rf24_tx_pending(r))
+			tx_finish(n, 1);
+		return;
+	}
+
+	/* Those after a failed one are thrown away, let them go first */
+	if (n->tx.failed) {
+		if (rf24_tx_pending(r))
+			return;
+		n->tx.failed = 0;
+		tx_go_back(n);
+		if (!n->tx.active)
+			return;
+	}
+
+	while (!n->tx.sync && n->tx.next < n->tx.nfrag &&
+	       n->tx.next - n->tx.acked < n->window &&
+	       !tx_frame(n, n->tx.next)) {
+		n->tx.next++;
+		n->tx.top = max_t(uint8_t, n->tx.top, n->tx.next);
+		n->stats.frames++;
+		sent = 1;
+	}
+	if (sent || rf24_tx_pending(r))
+		return;
+
+	/* All the window allows is out, or we are syncing: ask where it is */
+	if (n->tx.polls++ < POLLS) {
+		f[F_SRC] = n->tx.src;
+		f[F_DST] = n->tx.dst;
+		f[F_SEQ] = 0;
+		f[F_FLAGS] = POLL;
+		rf24_send(r, f, sizeof(f));
+		n->stats.polls++;
+	} else {
+		tx_go_back(n);
+	}
+}
+
+/**
+ * Join the network
+ *
+ * Call rf24_init() first, and set the channel, data rate and such, the
+ * same on all nodes. This enables dynamic and ack payloads, opens the
+ * pipes and starts listening.
+ *
+ * @param n rf24_net instance to act upon
+ * @param net The 4 byte network address
+ * @param id This node's id, RF24_NET_HUB or 1 to RF24_NET_MAX_ID
+ */
+void rf24_net_init(struct rf24_net *n, const uint8_t *net, uint8_t id)
+{
+	struct rf24 *r = &n->radio;
+	uint8_t a[5];
+	int i;
+
+	n->id = id;
+	memcpy(n->net, net, 4);
+	n->window = RF24_NET_WINDOW;
+	n->ack_loaded = n->ack_dirty = n->ack_idle = n->ack_turn = 0;
+	n->clock = 0;
+	memset(&n->tx, 0, sizeof(n->tx));
+	memset(&n->stats, 0, sizeof(n->stats));
+	for (i = 0; i < RF24_NET_PEERS; i++)
+		n->peer[i].id = 0xff;
+
+	r->tx_done = tx_done;
+	rf24_enable_dynamic_payloads(r);
+	rf24_enable_ack_payload(r);
+	/* Nodes retrying in step would collide every time */
+	rf24_set_retries(r, 1 + id % 8, 15);
+
+	if (id == RF24_NET_HUB) {
+		for (i = 1; i < 6; i++) {
+			a[0] = HUB_PIPE_ADDR + i;
+			memcpy(&a[1], net, 4);
+			rf24_open_reading_pipe(r, i, a);
+		}
+	} else {
+		address(n, id, RF24_NET_HUB, a);
+		rf24_open_reading_pipe(r, 1, a);
+	}
+	rf24_start_listening(r);
+}
+
+/**
+ * Start sending a message
+ *
+ * Returns at once, rf24_net_poll() does the rest and calls n->sent()
+ * when it's done. Messages for other leaves go through the hub.
+ *
+ * @param n rf24_net instance to act upon
+ * @param dst Where to
+ * @param msg The message. It's not copied, keep it until n->sent()
+ * @param len Up to RF24_NET_MTU bytes
+ * @return 0 if started, -1 if busy with another one or it's invalid
+ */
+int rf24_net_send(struct rf24_net *n, uint8_t dst, const void *msg, int len)
+{
+	if (n->tx.active || dst == n->id || dst > RF24_NET_MAX_ID ||
+	    len < 0 || len > RF24_NET_MTU)
+		return -1;
+	/* Going to transmit drops what the radio has, take it first */
+	rf24_irq(&n->radio);
+	rx_poll(n);
+	return tx_start(n, n->id == RF24_NET_HUB ? dst : RF24_NET_HUB,
+			n->id, dst, msg, len);
+}
+
+/**
+ * Whether a message from rf24_net_send() is still on its way
+ *
+ * @param n rf24_net instance to act upon
+ */
+int rf24_net_busy(struct rf24_net *n)
+{
+	return n->tx.active && !n->tx.fwd;
+}
+
+/**
+ * Do the work
+ *
+ * Call from the main loop, and whenever the radio's IRQ line goes low.
+ *
+ * @param n rf24_net instance to act upon
+ */
+void rf24_net_poll(struct rf24_net *n)
+{
+	struct rf24_net_peer *p;
+
+	rf24_irq(&n->radio);
+	if (n->tx.active) {
+		tx_poll(n);
+		return;
+	}
+	rx_poll(n);
+
+	/* The hub passes on what's for other leaves, one at a time */
+	for (p = n->peer; p < n->peer + RF24_NET_PEERS; p++)
+		if (p->ready) {
+			if (tx_start(n, p->dst, p->src, p->dst, p->buf, p->len)) {
+				p->ready = 0;
+				n->stats.dropped++;
+			} else {
+				n->tx.fwd = p;
+			}
+			break;
+		}
+}
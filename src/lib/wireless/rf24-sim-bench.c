@@ -0,0 +1,248 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arch/antares.h>
+#include <arch/delay.h>
+#include <lib/RF24.h>
+#include <lib/nRF24L01.h>
+#include <lib/rf24-sim.h>
+
+/*
+ * Runs the rf24 transmit and receive paths against the simulated
+ * radios, checks every packet made it exactly once and that every
+ * one reported sent was received, and times them on the simulator's
+ * clock.
+ */
+
+#define N       CONFIG_LIB_RF24_SIM_BENCH_PACKETS
+#define LOSS    CONFIG_LIB_RF24_SIM_BENCH_LOSS
+
+static uint8_t addr[2][5] = {
+	{ 0x11, 0xc2, 0xc2, 0xc2, 0xc2 },
+	{ 0x22, 0xc2, 0xc2, 0xc2, 0xc2 },
+};
+
+static struct rf24 tx[2], rx;
+static struct rf24_sim_stats t0;
+static unsigned long long ns0;
+static uint8_t seen[2][N], acked[2][N];
+static unsigned long delivered, dups, corrupt, ok, failed;
+static int errors;
+
+/* A packet: who sent it, its number, and a pattern to check */
+static void fill(uint8_t *p, int who, unsigned long seq)
+{
+	int i;
+	p[0] = who;
+	memcpy(&p[1], &seq, sizeof(seq));
+	for (i = 1 + sizeof(seq); i < 32; i++)
+		p[i] = seq * 7 + who + i;
+}
+
+static void got(const uint8_t *p, int len)
+{
+	uint8_t want[32];
+	unsigned long seq;
+
+	memcpy(&seq, &p[1], sizeof(seq));
+	if (len != 32 || p[0] > 1 || seq >= N) {
+		corrupt++;
+		return;
+	}
+	fill(want, p[0], seq);
+	if (memcmp(p, want, 32))
+		corrupt++;
+	else if (seen[p[0]][seq]++)
+		dups++;
+	else
+		delivered++;
+}
+
+static void rx_irq(struct rf24 *r)
+{
+	uint8_t buf[32];
+#ifdef CONFIG_LIB_RF24_RXQ
+	uint8_t pipe;
+	int len;
+
+	rf24_irq(r);
+	for (pipe = 1; pipe <= 2; pipe++)
+		while ((len = rf24_recv(r, pipe, buf, sizeof(buf))) >= 0)
+			got(buf, len);
+#else
+	rf24_write_register(r, STATUS, (1<<RX_DR));
+	while (!(rf24_read_register(r, FIFO_STATUS) & (1<<RX_EMPTY))) {
+		rf24_read(r, buf, sizeof(buf));
+		got(buf, sizeof(buf));
+	}
+#endif
+}
+
+#ifdef CONFIG_LIB_RF24_ASYNC
+static unsigned long done[2];
+
+/* Completions come in order, so the count is the packet number */
+static void tx_done(struct rf24 *r, int success)
+{
+	int who = r - tx;
+	if (success) {
+		acked[who][done[who]] = 1;
+		ok++;
+	} else {
+		failed++;
+	}
+	done[who]++;
+}
+
+static void tx_irq(struct rf24 *r)
+{
+	rf24_irq(r);
+}
+#endif
+
+/* Attaching the same number again starts that radio afresh */
+static void radio(int n, struct rf24 *r, void (*irq)(struct rf24 *r))
+{
+	memset(r, 0, sizeof(*r));
+	rf24_sim_attach(n, r, irq);
+	rf24_init(r);
+	rf24_set_data_rate(r, RF24_2MBPS);
+}
+
+/*
+ * Fresh radios for every run: senders on pipes 1 and 2 of the
+ * receiver, with different retransmit delays, or they'd collide in
+ * lockstep for good once they have. rf24_write() wants the TX
+ * interrupts left alone, so its sender gets no handler.
+ */
+static void setup(int senders, int ack, void (*irq)(struct rf24 *r))
+{
+	int i;
+
+	memset(seen, 0, sizeof(seen));
+	memset(acked, 0, sizeof(acked));
+	delivered = dups = corrupt = ok = failed = 0;
+
+	radio(0, &rx, rx_irq);
+	for (i = 0; i < senders; i++) {
+		radio(1 + i, &tx[i], irq);
+		rf24_set_retries(&tx[i], 1 + 2 * i, 15);
+		rf24_set_auto_ack(&tx[i], ack);
+		rf24_open_writing_pipe(&tx[i], addr[i]);
+		rf24_open_reading_pipe(&rx, 1 + i, addr[i]);
+#ifdef CONFIG_LIB_RF24_ASYNC
+		tx[i].tx_done = tx_done;
+		done[i] = 0;
+#endif
+	}
+	rf24_set_auto_ack(&rx, ack);
+	rf24_start_listening(&rx);
+
+	t0 = rf24_sim_air.stats;
+	ns0 = rf24_sim_air.now;
+}
+
+/* Let the last acks land, check and print, get the radios off the air */
+static void report(const char *what, int senders, int ack)
+{
+	struct rf24_sim_stats *s = &rf24_sim_air.stats;
+	double t = (rf24_sim_air.now - ns0) / 1e9;
+	unsigned long sent = senders * N, missing = 0, i;
+	int who;
+
+	delay_us(1000);
+	for (who = 0; who < senders; who++) {
+		for (i = 0; i < N; i++)
+			if (ack && acked[who][i] && !seen[who][i])
+				missing++;
+		rf24_power_down(&tx[who]);
+	}
+	rf24_stop_listening(&rx);
+	rf24_power_down(&rx);
+
+	printf("%-28s %6.1f ms %6.0f kbit/s %5.1f us/packet %5.1f SPI/packet "
+	       "%5lu/%lu delivered %4lu retx %4lu lost\n",
+	       what, t * 1e3, delivered * 32 * 8 / t / 1e3, t * 1e6 / sent,
+	       (double) (s->transactions - t0.transactions) / sent,
+	       delivered, sent, s->retransmits - t0.retransmits,
+	       s->lost - t0.lost);
+
+	if (dups || corrupt || missing || s->errors != t0.errors ||
+	    (ack && ok + failed != sent) ||
+	    (ack && senders == 1 && !rf24_sim_air.loss && delivered != sent)) {
+		printf("%-28s %lu dups, %lu corrupt, %lu acked but missing, "
+		       "%lu driver errors, %lu/%lu completed: FAILED\n",
+		       what, dups, corrupt, missing, s->errors - t0.errors,
+		       ok + failed, sent);
+		errors++;
+	}
+}
+
+static void bench_write(void)
+{
+	uint8_t buf[32];
+	unsigned long i;
+
+	setup(1, 1, NULL);
+	for (i = 0; i < N; i++) {
+		fill(buf, 0, i);
+		if (rf24_write(&tx[0], buf, sizeof(buf))) {
+			acked[0][i] = 1;
+			ok++;
+		} else {
+			failed++;
+		}
+	}
+	report(rf24_sim_air.loss ? "rf24_write, lossy" : "rf24_write", 1, 1);
+}
+
+#ifdef CONFIG_LIB_RF24_ASYNC
+static void bench_send(const char *what, int senders, int ack)
+{
+	uint8_t buf[32];
+	unsigned long sent[2] = { 0, 0 };
+	int i, busy, queued;
+
+	setup(senders, ack, tx_irq);
+	do {
+		busy = queued = 0;
+		for (i = 0; i < senders; i++) {
+			if (sent[i] < N) {
+				fill(buf, i, sent[i]);
+				if (!rf24_send(&tx[i], buf, sizeof(buf))) {
+					sent[i]++;
+					queued = 1;
+				}
+			}
+			busy |= sent[i] < N || rf24_tx_pending(&tx[i]);
+		}
+		/* Queues full, wait for an interrupt */
+		if (busy && !queued)
+			rf24_sim_sleep(1000000);
+	} while (busy);
+	report(what, senders, ack);
+}
+#endif
+
+ANTARES_APP(rf24_sim_bench)
+{
+	printf("rf24-sim-bench: %d packets of 32 bytes, 2 Mbps, %d kHz SPI\n",
+	       N, rf24_sim_air.spi_khz);
+
+	bench_write();
+#ifdef CONFIG_LIB_RF24_ASYNC
+	bench_send("rf24_send", 1, 1);
+	bench_send("rf24_send, no ack", 1, 0);
+	bench_send("rf24_send, 2 senders", 2, 1);
+#endif
+
+	rf24_sim_air.loss = LOSS;
+	bench_write();
+#ifdef CONFIG_LIB_RF24_ASYNC
+	bench_send("rf24_send, lossy", 1, 1);
+	bench_send("rf24_send, 2 senders, lossy", 2, 1);
+#endif
+
+	printf("rf24-sim-bench: %s\n", errors ? "FAILED" : "all good");
+	exit(errors ? 1 : 0);
+}
@@ -0,0 +1,813 @@
+/*
+ * nRF24L01+ behavioural model, native arch only.
+ *
+ * What's modelled: the SPI command set, the register map with its
+ * reset values, the three entry TX and RX FIFOs, ack payloads
+ * (which share the TX FIFO with a pipe tag, as on the chip), the
+ * standby-I/II, TX and RX states with their settling times, Enhanced
+ * ShockBurst packets with PID duplicate detection, auto-ack, ARD/ARC
+ * retransmits and MAX_RT, static and dynamic payload widths, the IRQ
+ * line and its masks. What isn't: carrier detect, RPD, the PLL and
+ * continuous wave test modes, ACTIVATE (this is the + variant).
+ *
+ * All radios share one virtual clock and one air. A packet reaches
+ * everybody listening on the same channel, data rate, address width
+ * and CRC setting, after 'latency_ns', unless it's lost at random,
+ * or overlaps another packet on the same channel.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arch/delay.h>
+#include <generic/macros.h>
+#include <lib/RF24.h>
+#include <lib/nRF24L01.h>
+#include <lib/rf24-sim.h>
+
+#define NRADIOS       RF24_SIM_RADIOS
+
+/* Datasheet timings, ns */
+#define T_PD2STBY     1500000
+#define T_STBY2A      130000
+
+#define STATUS_IRQS   ((1<<RX_DR) | (1<<TX_DS) | (1<<MAX_RT))
+
+enum {
+	IDLE = 0,                /* Standby, RX or power down */
+	TX_SETTLE,               /* next: the packet goes on air */
+	TX_AIR,                  /* next: it's all out */
+	TX_ACK,                  /* next: give up waiting for the ack */
+};
+
+struct payload {
+	uint8_t len;
+	uint8_t pipe;            /* Ack payloads only */
+	uint8_t noack;
+	uint8_t data[32];
+};
+
+struct radio {
+	struct rf24 *r;
+	void (*irq)(struct rf24 *r);
+	int used;
+
+	uint8_t reg[0x20];
+	uint8_t addr[2][5];      /* RX_ADDR_P0 and P1, LSB first */
+	uint8_t tx_addr[5];
+
+	struct payload tx[3];
+	int ntx;
+	struct payload rx[3];
+	int nrx;
+	struct payload last_ack[6];
+	uint8_t last_pid[6];
+	uint16_t last_sum[6];
+
+	int ce, csn, pulse;
+	unsigned long long ready;        /* Oscillator up */
+	unsigned long long listening;    /* RX settled */
+	unsigned long long busy;         /* Sending an ack */
+
+	/* SPI transaction in progress */
+	int pos;
+	uint8_t cmd;
+	struct payload wbuf;
+
+	int state;
+	unsigned long long next;
+	unsigned long long tx_start;
+	int arc;
+	uint8_t pid;
+
+	int line, pending;
+};
+
+/* One packet in flight, kept until nobody can collide with it */
+struct air_packet {
+	int from;
+	unsigned long long start, end;
+	uint8_t ch, setup, aw, ack;
+	uint8_t addr[5];
+	uint8_t pid, dyn;
+	struct payload p;
+};
+
+/* On their way, to be looked at when they arrive */
+struct arrival {
+	unsigned long long at;
+	int to;
+	struct air_packet pkt;
+};
+
+#define LOG_SIZE      64
+#define MAX_ARRIVALS  (NRADIOS * 4)
+
+struct rf24_sim_air rf24_sim_air = {
+	.spi_khz = 8000,
+};
+
+static struct radio radios[NRADIOS];
+static struct air_packet air_log[LOG_SIZE];
+static int log_pos;
+static struct arrival arrivals[MAX_ARRIVALS];
+static int narrivals;
+static int in_irq;
+
+#define air (&rf24_sim_air)
+
+static void advance(unsigned long long to);
+
+static void error(struct radio *s, const char *what)
+{
+	fprintf(stderr, "rf24-sim: radio %d: %s\n", (int) (s - radios), what);
+	air->stats.errors++;
+}
+
+/* Register helpers */
+
+static int aw(struct radio *s)
+{
+	int w = s->reg[SETUP_AW] & 3;
+	return w ? w + 2 : 5;
+}
+
+static int ard_ns(struct radio *s)
+{
+	return ((s->reg[SETUP_RETR] >> ARD) + 1) * 250000;
+}
+
+static int bit_ns(uint8_t setup)
+{
+	if (setup & (1<<RF_DR_LOW))
+		return 4000;
+	if (setup & (1<<RF_DR_HIGH))
+		return 500;
+	return 1000;
+}
+
+static int crc_bytes(struct radio *s)
+{
+	if (!(s->reg[CONFIG] & (1<<EN_CRC)) && !s->reg[EN_AA])
+		return 0;
+	return (s->reg[CONFIG] & (1<<CRCO)) ? 2 : 1;
+}
+
+/* Preamble, address, 9 bit packet control field, payload, CRC */
+static unsigned long long air_ns(struct radio *s, int len)
+{
+	int bits = 8 * (1 + aw(s) + len + crc_bytes(s)) + 9;
+	return (unsigned long long) bits * bit_ns(s->reg[RF_SETUP]);
+}
+
+static int dpl(struct radio *s, int pipe)
+{
+	return (s->reg[FEATURE] & (1<<EN_DPL)) && (s->reg[DYNPD] & (1<<pipe));
+}
+
+static int powered(struct radio *s)
+{
+	return (s->reg[CONFIG] & (1<<PWR_UP)) && air->now >= s->ready;
+}
+
+static int prx(struct radio *s)
+{
+	return s->reg[CONFIG] & (1<<PRIM_RX);
+}
+
+static void pipe_addr(struct radio *s, int pipe, uint8_t *a)
+{
+	memcpy(a, s->addr[pipe ? 1 : 0], 5);
+	if (pipe > 1)
+		a[0] = s->reg[RX_ADDR_P0 + pipe];
+}
+
+/* STATUS and FIFO_STATUS are computed, the rest are stored */
+static uint8_t status(struct radio *s)
+{
+	uint8_t st = s->reg[STATUS] & STATUS_IRQS;
+	st |= (s->nrx ? s->rx[0].pipe : 7) << RX_P_NO;
+	if (s->ntx == 3)
+		st |= 1<<TX_FULL;
+	return st;
+}
+
+static uint8_t fifo_status(struct radio *s)
+{
+	uint8_t f = 0;
+	if (!s->ntx)
+		f |= 1<<TX_EMPTY;
+	if (s->ntx == 3)
+		f |= 1<<FIFO_FULL;
+	if (!s->nrx)
+		f |= 1<<RX_EMPTY;
+	if (s->nrx == 3)
+		f |= 1<<RX_FULL;
+	return f;
+}
+
+/* The IRQ pin, active low, interrupts on the falling edge */
+static void update_irq(struct radio *s)
+{
+	int masked = s->reg[CONFIG] & 0x70;
+	int line = (s->reg[STATUS] & STATUS_IRQS & ~masked) != 0;
+	if (line && !s->line)
+		s->pending = 1;
+	s->line = line;
+}
+
+static void set_flag(struct radio *s, int bit)
+{
+	s->reg[STATUS] |= 1 << bit;
+	update_irq(s);
+}
+
+static uint16_t sum(const struct payload *p)
+{
+	uint16_t v = p->len;
+	int i;
+	for (i = 0; i < p->len; i++)
+		v = (v << 1 | v >> 15) ^ p->data[i];
+	return v;
+}
+
+static void reset(struct radio *s)
+{
+	static const uint8_t regs[0x20] = {
+		[CONFIG] = 0x08, [EN_AA] = 0x3f, [EN_RXADDR] = 0x03,
+		[SETUP_AW] = 0x03, [SETUP_RETR] = 0x03, [RF_CH] = 0x02,
+		[RF_SETUP] = 0x0e, [STATUS] = 0x0e, [RX_ADDR_P2] = 0xc3,
+		[RX_ADDR_P3] = 0xc4, [RX_ADDR_P4] = 0xc5,
+		[RX_ADDR_P5] = 0xc6, [FIFO_STATUS] = 0x11,
+	};
+	struct rf24 *r = s->r;
+	void (*irq)(struct rf24 *r) = s->irq;
+
+	memset(s, 0, sizeof(*s));
+	memcpy(s->reg, regs, sizeof(regs));
+	s->reg[STATUS] = 0;
+	memset(s->addr[0], 0xe7, 5);
+	memset(s->addr[1], 0xc2, 5);
+	memset(s->tx_addr, 0xe7, 5);
+	memset(s->last_pid, 0xff, sizeof(s->last_pid));
+	s->csn = 1;
+	s->line = 0;
+	s->r = r;
+	s->irq = irq;
+	s->used = 1;
+}
+
+/* PTX: start the next packet if the chip would */
+
+static void tx_next(struct radio *s, unsigned long long settle)
+{
+	if (s->state != IDLE || prx(s) || !s->ntx ||
+	    !(s->reg[CONFIG] & (1<<PWR_UP)) ||
+	    (s->reg[STATUS] & (1<<MAX_RT)) || !(s->ce || s->pulse))
+		return;
+	s->pulse = 0;
+	s->state = TX_SETTLE;
+	s->next = max_t(unsigned long long, air->now, s->ready) + settle;
+	s->arc = 0;
+	s->pid = (s->pid + 1) & 3;
+}
+
+static void log_packet(struct air_packet *p)
+{
+	air_log[log_pos] = *p;
+	log_pos = (log_pos + 1) % LOG_SIZE;
+}
+
+static int collided(struct air_packet *p)
+{
+	int i;
+	for (i = 0; i < LOG_SIZE; i++) {
+		struct air_packet *o = &air_log[i];
+		if (o->end == 0 || o->ch != p->ch)
+			continue;
+		if (o->from == p->from && o->start == p->start)
+			continue;
+		if (o->start < p->end && p->start < o->end)
+			return 1;
+	}
+	return 0;
+}
+
+static int lost()
+{
+	return air->loss && (unsigned) (rand() % 1000) < air->loss;
+}
+
+static void send(struct radio *s, int to, struct air_packet *p)
+{
+	int i;
+	for (i = 0; i < NRADIOS; i++) {
+		struct arrival *a;
+		if (!radios[i].used || &radios[i] == s || (to >= 0 && i != to))
+			continue;
+		if (narrivals == MAX_ARRIVALS) {
+			error(s, "too many packets in the air");
+			return;
+		}
+		a = &arrivals[narrivals++];
+		a->at = p->end + air->latency_ns;
+		a->to = i;
+		a->pkt = *p;
+	}
+	air->stats.sent++;
+}
+
+static void tx_air(struct radio *s)
+{
+	struct air_packet p;
+
+	memset(&p, 0, sizeof(p));
+	p.from = s - radios;
+	p.start = air->now;
+	p.end = air->now + air_ns(s, s->tx[0].len);
+	p.ch = s->reg[RF_CH];
+	p.setup = s->reg[RF_SETUP] & ((1<<RF_DR_LOW) | (1<<RF_DR_HIGH));
+	p.aw = aw(s) | crc_bytes(s) << 4;
+	memcpy(p.addr, s->tx_addr, 5);
+	p.pid = s->pid;
+	p.dyn = dpl(s, 0);
+	p.p = s->tx[0];
+	log_packet(&p);
+	send(s, -1, &p);
+	if (s->arc)
+		air->stats.retransmits++;
+
+	s->tx_start = p.start;
+	s->state = TX_AIR;
+	s->next = p.end;
+}
+
+/* Straight on if the chip is still in TX, via RX it has to settle again */
+static void tx_done(struct radio *s, unsigned long long settle)
+{
+	memmove(&s->tx[0], &s->tx[1], sizeof(s->tx[0]) * --s->ntx);
+	s->reg[OBSERVE_TX] &= 0xf0;
+	s->reg[OBSERVE_TX] |= s->arc;
+	set_flag(s, TX_DS);
+	s->state = IDLE;
+	tx_next(s, settle);
+}
+
+static void tx_event(struct radio *s)
+{
+	switch (s->state) {
+	case TX_SETTLE:
+		if (!s->ntx) {
+			s->state = IDLE;
+			break;
+		}
+		tx_air(s);
+		break;
+	case TX_AIR:
+		if (!(s->reg[EN_AA] & (1<<ENAA_P0)) || s->tx[0].noack) {
+			tx_done(s, 0);
+			break;
+		}
+		s->state = TX_ACK;
+		s->next = air->now + ard_ns(s);
+		break;
+	case TX_ACK:
+		if (s->arc == (s->reg[SETUP_RETR] & 0xf)) {
+			if ((s->reg[OBSERVE_TX] >> PLOS_CNT) < 15)
+				s->reg[OBSERVE_TX] += 1 << PLOS_CNT;
+			s->state = IDLE;
+			set_flag(s, MAX_RT);
+			break;
+		}
+		s->arc++;
+		tx_air(s);
+		break;
+	}
+}
+
+/* An ack for us, if it's for what we're waiting for */
+static void ack_arrived(struct radio *s, struct air_packet *p)
+{
+	uint8_t a[5];
+
+	pipe_addr(s, 0, a);
+	if (s->state != TX_ACK || p->pid != s->pid ||
+	    memcmp(p->addr, s->tx_addr, 5) || memcmp(a, s->tx_addr, 5))
+		return;
+	if (lost() || collided(p)) {
+		air->stats.lost++;
+		return;
+	}
+	if (p->p.len) {
+		if (s->nrx < 3) {
+			s->rx[s->nrx] = p->p;
+			s->rx[s->nrx++].pipe = 0;
+			set_flag(s, RX_DR);
+			air->stats.delivered++;
+		} else {
+			air->stats.lost++;
+		}
+	}
+	tx_done(s, T_STBY2A);
+}
+
+static int match_pipe(struct radio *s, struct air_packet *p)
+{
+	uint8_t a[5];
+	int i;
+	for (i = 0; i < 6; i++) {
+		if (!(s->reg[EN_RXADDR] & (1<<i)))
+			continue;
+		pipe_addr(s, i, a);
+		if (!memcmp(a, p->addr, aw(s)))
+			return i;
+	}
+	return -1;
+}
+
+/* PRX side of a packet */
+static void packet_arrived(struct radio *s, struct air_packet *p)
+{
+	int pipe, dup, i;
+	struct air_packet ack;
+
+	if (!powered(s) || !prx(s) || !s->ce || s->listening > p->start ||
+	    s->busy > p->start || p->ch != s->reg[RF_CH] ||
+	    p->setup != (s->reg[RF_SETUP] & ((1<<RF_DR_LOW) | (1<<RF_DR_HIGH))) ||
+	    p->aw != (aw(s) | crc_bytes(s) << 4))
+		return;
+	pipe = match_pipe(s, p);
+	if (pipe < 0)
+		return;
+	if (lost() || collided(p)) {
+		air->stats.lost++;
+		return;
+	}
+	/* Wrong widths get the CRC wrong */
+	if (dpl(s, pipe) ? !p->dyn : p->dyn || p->p.len != s->reg[RX_PW_P0 + pipe]) {
+		air->stats.lost++;
+		return;
+	}
+
+	dup = p->pid == s->last_pid[pipe] && sum(&p->p) == s->last_sum[pipe];
+	if (!dup) {
+		if (s->nrx == 3) {
+			air->stats.lost++;
+			return;
+		}
+		s->rx[s->nrx] = p->p;
+		s->rx[s->nrx++].pipe = pipe;
+		s->last_pid[pipe] = p->pid;
+		s->last_sum[pipe] = sum(&p->p);
+		set_flag(s, RX_DR);
+		air->stats.delivered++;
+	}
+
+	if (!(s->reg[EN_AA] & (1<<pipe)) || p->p.noack)
+		return;
+
+	/* The ack goes back with the pipe's address and the same PID */
+	if (!dup) {
+		memset(&s->last_ack[pipe], 0, sizeof(s->last_ack[pipe]));
+		for (i = 0; i < s->ntx; i++)
+			if (s->tx[i].pipe == pipe)
+				break;
+		if (i < s->ntx && (s->reg[FEATURE] & (1<<EN_ACK_PAY))) {
+			s->last_ack[pipe] = s->tx[i];
+			memmove(&s->tx[i], &s->tx[i + 1],
+				sizeof(s->tx[0]) * (--s->ntx - i));
+			set_flag(s, TX_DS);
+		}
+	}
+	memset(&ack, 0, sizeof(ack));
+	ack.from = s - radios;
+	ack.start = air->now + T_STBY2A;
+	ack.end = ack.start + air_ns(s, s->last_ack[pipe].len);
+	ack.ch = p->ch;
+	memcpy(ack.addr, p->addr, 5);
+	ack.pid = p->pid;
+	ack.ack = 1;
+	ack.p = s->last_ack[pipe];
+	ack.p.noack = 0;
+	log_packet(&ack);
+	send(s, p->from, &ack);
+	s->busy = ack.end + T_STBY2A;
+}
+
+/* The air */
+
+static unsigned long long next_event(int *who)
+{
+	unsigned long long t = ~0ULL;
+	int i;
+	*who = -1;
+	for (i = 0; i < NRADIOS; i++)
+		if (radios[i].used && radios[i].state != IDLE &&
+		    radios[i].next < t) {
+			t = radios[i].next;
+			*who = i;
+		}
+	for (i = 0; i < narrivals; i++)
+		if (arrivals[i].at < t) {
+			t = arrivals[i].at;
+			*who = NRADIOS + i;
+		}
+	return t;
+}
+
+static int dispatch_irqs()
+{
+	int i, n = 0, again = 1;
+	if (in_irq)
+		return 0;
+	while (again) {
+		again = 0;
+		for (i = 0; i < NRADIOS; i++) {
+			struct radio *s = &radios[i];
+			if (!s->pending)
+				continue;
+			s->pending = 0;
+			if (!s->irq)
+				continue;
+			air->stats.irqs++;
+			in_irq = 1;
+			s->irq(s->r);
+			in_irq = 0;
+			again = 1;
+			n++;
+		}
+	}
+	return n;
+}
+
+/* Runs one event, if there's one before 'to' */
+static int step(unsigned long long to)
+{
+	int who;
+	unsigned long long t = next_event(&who);
+
+	if (who < 0 || t > to)
+		return 0;
+	air->now = t;
+	if (who < NRADIOS) {
+		tx_event(&radios[who]);
+	} else {
+		struct arrival a = arrivals[who - NRADIOS];
+		arrivals[who - NRADIOS] = arrivals[--narrivals];
+		if (a.pkt.ack)
+			ack_arrived(&radios[a.to], &a.pkt);
+		else
+			packet_arrived(&radios[a.to], &a.pkt);
+	}
+	return 1;
+}
+
+static void advance(unsigned long long to)
+{
+	while (step(to))
+		dispatch_irqs();
+	if (air->now < to)
+		air->now = to;
+	dispatch_irqs();
+}
+
+void rf24_sim_sleep(unsigned long long max_ns)
+{
+	unsigned long long to = air->now + max_ns;
+	while (step(to))
+		if (dispatch_irqs())
+			return;
+	if (air->now < to)
+		air->now = to;
+}
+
+void delay_us(unsigned long us)
+{
+	advance(air->now + us * 1000ULL);
+}
+
+/* SPI */
+
+static void write_reg(struct radio *s, uint8_t reg, int pos, uint8_t v)
+{
+	uint8_t old = s->reg[CONFIG];
+
+	if (reg == RX_ADDR_P0 || reg == RX_ADDR_P1) {
+		if (pos < 5)
+			s->addr[reg - RX_ADDR_P0][pos] = v;
+		return;
+	}
+	if (reg == TX_ADDR) {
+		if (pos < 5)
+			s->tx_addr[pos] = v;
+		return;
+	}
+	if (pos)
+		return;
+
+	switch (reg) {
+	case STATUS:
+		s->reg[STATUS] &= ~(v & STATUS_IRQS);
+		update_irq(s);
+		tx_next(s, T_STBY2A);
+		return;
+	case OBSERVE_TX:
+	case CD:
+	case FIFO_STATUS:
+		return;
+	case RF_CH:
+		v &= 0x7f;
+		s->reg[OBSERVE_TX] &= 0x0f;
+		break;
+	case RX_PW_P0: case RX_PW_P1: case RX_PW_P2:
+	case RX_PW_P3: case RX_PW_P4: case RX_PW_P5:
+		v &= 0x3f;
+		break;
+	}
+	s->reg[reg] = v;
+
+	if (reg == CONFIG) {
+		if ((v & (1<<PWR_UP)) && !(old & (1<<PWR_UP)))
+			s->ready = air->now + T_PD2STBY;
+		if (!(v & (1<<PWR_UP)) || (v ^ old) & (1<<PRIM_RX))
+			s->state = IDLE;
+		if (prx(s) && s->ce)
+			s->listening = max_t(unsigned long long, air->now,
+					     s->ready) + T_STBY2A;
+		update_irq(s);
+		tx_next(s, T_STBY2A);
+	}
+}
+
+static uint8_t read_reg(struct radio *s, uint8_t reg, int pos)
+{
+	if (reg == RX_ADDR_P0 || reg == RX_ADDR_P1)
+		return pos < 5 ? s->addr[reg - RX_ADDR_P0][pos] : 0;
+	if (reg == TX_ADDR)
+		return pos < 5 ? s->tx_addr[pos] : 0;
+	if (pos)
+		return 0;
+	if (reg == STATUS)
+		return status(s);
+	if (reg == FIFO_STATUS)
+		return fifo_status(s);
+	return s->reg[reg];
+}
+
+static void end_transaction(struct radio *s)
+{
+	struct payload *p = &s->wbuf;
+
+	if (s->pos < 2)
+		return;
+	if (s->cmd == W_TX_PAYLOAD || s->cmd == 0xb0 ||
+	    (s->cmd & 0xf8) == W_ACK_PAYLOAD) {
+		if (s->ntx == 3)
+			return;
+		p->noack = s->cmd == 0xb0;
+		p->pipe = (s->cmd & 0xf8) == W_ACK_PAYLOAD ? s->cmd & 7 : 0;
+		s->tx[s->ntx++] = *p;
+		tx_next(s, T_STBY2A);
+	}
+	if (s->cmd == R_RX_PAYLOAD && s->nrx) {
+		memmove(&s->rx[0], &s->rx[1], sizeof(s->rx[0]) * --s->nrx);
+	}
+}
+
+static uint8_t sim_xfer(struct radio *s, uint8_t b)
+{
+	uint8_t ret = 0;
+	int i = s->pos - 1;
+
+	air->stats.spi_bytes++;
+	if (s->csn) {
+		error(s, "SPI transfer with CSN high");
+		goto out;
+	}
+
+	if (!s->pos) {
+		s->cmd = b;
+		ret = status(s);
+		memset(&s->wbuf, 0, sizeof(s->wbuf));
+		switch (b) {
+		case FLUSH_TX:
+			s->ntx = 0;
+			if (s->state != IDLE && !prx(s))
+				error(s, "FLUSH_TX while transmitting");
+			break;
+		case FLUSH_RX:
+			s->nrx = 0;
+			break;
+		case REUSE_TX_PL:
+			error(s, "REUSE_TX_PL isn't modelled");
+			break;
+		}
+	} else if (s->cmd < W_REGISTER + 0x20) {
+		if (s->cmd & W_REGISTER)
+			write_reg(s, s->cmd & REGISTER_MASK, i, b);
+		else
+			ret = read_reg(s, s->cmd & REGISTER_MASK, i);
+	} else if (s->cmd == R_RX_PL_WID) {
+		ret = i ? 0 : s->nrx ? s->rx[0].len : 0;
+	} else if (s->cmd == R_RX_PAYLOAD) {
+		ret = s->nrx && i < s->rx[0].len ? s->rx[0].data[i] : 0;
+		/* Static widths read out RX_PW bytes, DPL may read less */
+	} else if (s->cmd == W_TX_PAYLOAD || s->cmd == 0xb0 ||
+		   (s->cmd & 0xf8) == W_ACK_PAYLOAD) {
+		if (i < 32)
+			s->wbuf.data[s->wbuf.len++] = b;
+		else
+			error(s, "payload over 32 bytes");
+	}
+	s->pos++;
+out:
+	advance(air->now + 8000000ULL / air->spi_khz);
+	return ret;
+}
+
+static void sim_xfer_block(struct radio *s, const uint8_t *tx, uint8_t *rx, int len)
+{
+	uint8_t b;
+	while (len--) {
+		b = sim_xfer(s, tx ? *tx++ : 0xff);
+		if (rx)
+			*rx++ = b;
+	}
+}
+
+static void sim_csn(struct radio *s, int level)
+{
+	if (!level && !s->csn)
+		error(s, "CSN low twice, preempted mid transaction?");
+	if (level && !s->csn)
+		end_transaction(s);
+	if (!level) {
+		s->pos = 0;
+		air->stats.transactions++;
+	}
+	s->csn = level;
+}
+
+static void sim_ce(struct radio *s, int level)
+{
+	if (level && !s->ce) {
+		s->pulse = 1;
+		if (prx(s))
+			s->listening = max_t(unsigned long long, air->now,
+					     s->ready) + T_STBY2A;
+	}
+	s->ce = level;
+	if (!level)
+		s->pulse = 0;
+	tx_next(s, T_STBY2A);
+}
+
+static void sim_spi_set_speed(int khz)
+{
+	air->spi_khz = khz;
+}
+
+/* The callbacks have no context, so one set per radio */
+#define RADIO(n)							\
+	static void csn_ ## n(int l) { sim_csn(&radios[n], l); }	\
+	static void ce_ ## n(int l) { sim_ce(&radios[n], l); }		\
+	static uint8_t xfer_ ## n(uint8_t b) { return sim_xfer(&radios[n], b); } \
+	static void block_ ## n(const uint8_t *tx, uint8_t *rx, int len) \
+		{ sim_xfer_block(&radios[n], tx, rx, len); }
+
+RADIO(0) RADIO(1) RADIO(2) RADIO(3) RADIO(4) RADIO(5) RADIO(6) RADIO(7)
+RADIO(8) RADIO(9) RADIO(10) RADIO(11) RADIO(12) RADIO(13) RADIO(14) RADIO(15)
+RADIO(16) RADIO(17) RADIO(18) RADIO(19) RADIO(20) RADIO(21) RADIO(22) RADIO(23)
+RADIO(24) RADIO(25) RADIO(26) RADIO(27) RADIO(28) RADIO(29) RADIO(30) RADIO(31)
+
+#define CB(n) { csn_ ## n, ce_ ## n, xfer_ ## n, block_ ## n }
+
+static const struct {
+	void (*csn)(int);
+	void (*ce)(int);
+	uint8_t (*xfer)(uint8_t);
+	void (*block)(const uint8_t *, uint8_t *, int);
+} callbacks[NRADIOS] = {
+	CB(0), CB(1), CB(2), CB(3), CB(4), CB(5), CB(6), CB(7),
+	CB(8), CB(9), CB(10), CB(11), CB(12), CB(13), CB(14), CB(15),
+	CB(16), CB(17), CB(18), CB(19), CB(20), CB(21), CB(22), CB(23),
+	CB(24), CB(25), CB(26), CB(27), CB(28), CB(29), CB(30), CB(31),
+};
+
+void rf24_sim_attach(int n, struct rf24 *r, void (*irq)(struct rf24 *r))
+{
+	struct radio *s = &radios[n];
+
+	if (n < 0 || n >= NRADIOS) {
+		fprintf(stderr, "rf24-sim: no radio %d\n", n);
+		exit(1);
+	}
+	s->r = r;
+	s->irq = irq;
+	reset(s);
+	r->csn = callbacks[n].csn;
+	r->ce = callbacks[n].ce;
+	r->spi_xfer = callbacks[n].xfer;
+	r->spi_xfer_block = callbacks[n].block;
+	r->spi_set_speed = sim_spi_set_speed;
+}
@@ -3,11 +3,52 @@
 #include <lib/nRF24L01.h>
 #include <arch/delay.h>
 #include <lib/panic.h>
+#include <lib/circ_buf.h>
+#include <string.h>
 
-//#define DEBUG_LEVEL CONFIG_LIB_RF24_DEBUG
+#define DEBUG_LEVEL CONFIG_LIB_RF24_DEBUG
 #define COMPONENT "rf24"
 #include <lib/printk.h>
 
+/* Clock the data part of a transaction, through spi_xfer_block if there is one */
+static void xfer_data(struct rf24 *r, const uint8_t *tx, uint8_t *rx, uint8_t len)
+{
+	uint8_t b;
+	if (!len)
+		return;
+	if (r->spi_xfer_block) {
+		r->spi_xfer_block(tx, rx, len);
+		return;
+	}
+	while (len--) {
+		b = r->spi_xfer(tx ? *tx++ : 0xff);
+		if (rx)
+			*rx++ = b;
+	}
+}
+
+/*
+ * Our copy of the registers only we ever change, so setters and
+ * getters need not read them back. NULL if reg isn't one of them.
+ */
+static uint8_t *shadow(struct rf24 *r, uint8_t reg)
+{
+	if (reg <= RF_SETUP)
+		return &r->regs[reg];
+	if (reg == DYNPD || reg == FEATURE)
+		return &r->regs[RF_SETUP + 1 + reg - DYNPD];
+	return NULL;
+}
+
+/* Fill the shadow from the chip */
+static void shadow_load(struct rf24 *r)
+{
+	uint8_t reg;
+	for (reg = CONFIG; reg <= FEATURE; reg++)
+		if (shadow(r, reg))
+			*shadow(r, reg) = rf24_read_register(r, reg);
+}
+
 /**
  * Read a chunk of data in from a register
  *
@@ -23,9 +64,7 @@ uint8_t rf24_readout_register(struct rf24 *r,
 	uint8_t status;
 	r->csn(0);
 	status = r->spi_xfer( R_REGISTER | ( REGISTER_MASK & reg ) );
-	while ( len-- )
-		*buf++ = r->spi_xfer(0xff);
-
+	xfer_data(r, NULL, buf, len);
 	r->csn(1);
 	return status;
 }
@@ -33,6 +72,9 @@ uint8_t rf24_readout_register(struct rf24 *r,
 /**
  * Read single byte from a register
  *
+ * Always asks the chip. The driver itself uses its shadow copy for the
+ * configuration registers.
+ *
  * @param r rf24 instance to act upon
  * @param reg Which register. Use constants from nRF24L01.h
  * @return Current value of register @p reg
@@ -59,10 +101,11 @@ uint8_t rf24_read_register(struct rf24 *r, uint8_t reg)
 uint8_t rf24_writeout_register(struct rf24 *r, uint8_t reg, const uint8_t* buf, uint8_t len)
 {
 	uint8_t status;
+	if (len == 1 && shadow(r, reg))
+		*shadow(r, reg) = *buf;
 	r->csn(0);
 	status = r->spi_xfer( W_REGISTER | ( REGISTER_MASK & reg ) );
-	while ( len-- )
-		r->spi_xfer(*buf++);
+	xfer_data(r, buf, NULL, len);
 	r->csn(1);
 	return status;
 }
@@ -79,6 +122,8 @@ uint8_t rf24_write_register(struct rf24 *r, uint8_t reg, uint8_t value)
 {
 	uint8_t status;
 	trace("write_register(%02x,%02x)\n", reg, value);
+	if (shadow(r, reg))
+		*shadow(r, reg) = value;
 	r->csn(0);
 	status = r->spi_xfer( W_REGISTER | ( REGISTER_MASK & reg ) );
 	r->spi_xfer(value);
@@ -86,7 +131,8 @@ uint8_t rf24_write_register(struct rf24 *r, uint8_t reg, uint8_t value)
 	return status;
 }
 
-
+/* What a static payload shorter than payload_size is padded with */
+static const uint8_t zeroes[32];
 
 /**
  * Write the transmit payload
@@ -101,16 +147,13 @@ uint8_t rf24_write_register(struct rf24 *r, uint8_t reg, uint8_t value)
 uint8_t rf24_write_payload(struct rf24 *r, const void* buf, uint8_t len)
 {
 	uint8_t status;
-	const uint8_t* current = (uint8_t*) buf;
 	uint8_t data_len = min_t(uint8_t, len, r->payload_size);
 	uint8_t blank_len = rf24_has_dynamic_payload(r) ? 0 : r->payload_size - data_len;
 	dbg("Writing %u bytes %u blanks", data_len, blank_len);
 	r->csn(0);
 	status = r->spi_xfer( W_TX_PAYLOAD );
-	while ( data_len-- )
-		r->spi_xfer(*current++);
-	while ( blank_len-- )
-		r->spi_xfer(0);
+	xfer_data(r, buf, NULL, data_len);
+	xfer_data(r, zeroes, NULL, blank_len);
 	r->csn(1);
 	return status;
 }
@@ -128,16 +171,13 @@ uint8_t rf24_write_payload(struct rf24 *r, const void* buf, uint8_t len)
 uint8_t rf24_read_payload(struct rf24 *r, void* buf, uint8_t len)
 {
 	uint8_t status;
-	uint8_t* current = (uint8_t*) buf;
 	uint8_t data_len = min_t(uint8_t, len, r->payload_size);
 	uint8_t blank_len = rf24_has_dynamic_payload(r) ? 0 : r->payload_size - data_len;
 	dbg("Reading %u bytes %u blanks", data_len, blank_len);
 	r->csn(0);
 	status = r->spi_xfer( R_RX_PAYLOAD );
-	while ( data_len-- )
-		*current++ = r->spi_xfer(0xff);
-	while ( blank_len-- )
-		r->spi_xfer(0xff);
+	xfer_data(r, NULL, buf, data_len);
+	xfer_data(r, NULL, NULL, blank_len);
 	r->csn(1);
 	return status;
 }
@@ -312,6 +352,15 @@ void rf24_init(struct rf24 *r)
 	for (i=0; i< 5; i++)
 		r->pipe0_reading_address[i] = 0;
 	r->ack_payload_length = 0;
+	r->idle_mode = RF24_IDLE_STANDBY;
+#ifdef CONFIG_LIB_RF24_ASYNC
+	r->tx_head = r->tx_load = r->tx_tail = 0;
+#endif
+#ifdef CONFIG_LIB_RF24_RXQ
+	for (i = 0; i < RF24_RXQ_PIPES; i++)
+		r->rxq[i].head = r->rxq[i].tail = 0;
+	r->rx_dropped = 0;
+#endif
 
 	r->ce(0);
 	/*
@@ -325,6 +374,9 @@ void rf24_init(struct rf24 *r)
 	 */
 	delay_ms(5);
 
+	/* Whatever the chip was left with, the setters below work from it */
+	shadow_load(r);
+
 	/*
 	 * Set 1500uS (minimum for 32B payload in ESB@250KBPS) timeouts, to make testing a little easier
 	 * WARNING: If this is ever lowered, either 250KBS mode with AA is broken or maximum packet
@@ -399,7 +451,7 @@ void rf24_init(struct rf24 *r)
 void rf24_start_listening(struct rf24 *r)
 {
 	rf24_write_register(r, CONFIG,
-			    rf24_read_register(r, CONFIG) | (1<<PWR_UP) | (1<<PRIM_RX));
+			    *shadow(r, CONFIG) | (1<<PWR_UP) | (1<<PRIM_RX));
 	rf24_write_register(r, STATUS, (1<<RX_DR) | (1<<TX_DS) | (1<<MAX_RT) );
 
 	/* Write the pipe0 address */
@@ -430,6 +482,37 @@ void rf24_stop_listening(struct rf24 *r)
   rf24_flush_rx(r);
 }
 
+/* Oscillator start up, power down to standby, with some margin */
+#define RF24_PWR_UP_US 1500
+
+/* How often rf24_write() looks at the status, and for how long */
+#define RF24_POLL_US   10
+#define RF24_WRITE_US  100000
+
+/*
+ * Power up in PTX mode, waiting for the oscillator if it was off.
+ * Leaves CE alone.
+ */
+static void tx_mode(struct rf24 *r)
+{
+	uint8_t config = *shadow(r, CONFIG);
+	uint8_t want = (config | (1<<PWR_UP)) & ~(1<<PRIM_RX);
+
+	if (config != want)
+		rf24_write_register(r, CONFIG, want);
+	if (!(config & (1<<PWR_UP)))
+		delay_us(RF24_PWR_UP_US);
+}
+
+/* Nothing more to send, apply the idle policy */
+static void tx_idle(struct rf24 *r)
+{
+	if (r->idle_mode != RF24_IDLE_STANDBY_II)
+		r->ce(0);
+	if (r->idle_mode == RF24_IDLE_POWER_DOWN)
+		rf24_power_down(r);
+}
+
 /**
  * Write to the open writing pipe
  *
@@ -438,7 +521,8 @@ void rf24_stop_listening(struct rf24 *r)
  *
  * This blocks until the message is successfully acknowledged by
  * the receiver or the timeout/retransmit maxima are reached.  In
- * the current configuration, the max delay here is 60ms.
+ * the current configuration, the max delay here is 60ms. Afterwards
+ * the radio is left as set with rf24_set_idle_mode().
  *
  * The maximum size of data written is the fixed payload size, see
  * rf24_get_payload_size().  However, you can write less, and the remainder
@@ -447,42 +531,32 @@ void rf24_stop_listening(struct rf24 *r)
  * @param r rf24 instance to act upon
  * @param buf Pointer to the data to be sent
  * @param len Number of bytes to be sent
- * @return 0 if the payload was delivered successfully false if not
+ * @return non-null if the payload was delivered successfully 0 if not
  */
 int rf24_write(struct rf24 *r, const void* buf, uint8_t len )
 {
 	int ret = -1;
 	int tx_ok, tx_fail, ack_payload_available;
-	uint8_t observe_tx;
 	uint8_t status;
-	int timeout = 500; /* ms to wait for timeout */
+	long timeout = RF24_WRITE_US / RF24_POLL_US;
 
 	/* Begin the write */
 	rf24_start_write(r, buf, len);
 
 	/* 
-	 * At this point we could return from a non-blocking write, and then call
-	 * the rest after an interrupt
-	 *
-	 * Instead, we are going to block here until we get TX_DS (transmission completed and ack'd)
+	 * Block here until we get TX_DS (transmission completed and ack'd)
 	 * or MAX_RT (maximum retries, transmission failed).  Also, we'll timeout in case the radio
-	 * is flaky and we get neither.
-	 * IN the end, the send should be blocking.  It comes back in 60ms worst case, or much faster
-	 * if I tighted up the retry logic.  (Default settings will be 1500us.
-	 * Monitor the send
+	 * is flaky and we get neither. It comes back in 60ms worst case, much faster
+	 * with tighter retry settings. The status is what the chip clocks out
+	 * anyway, so looking at it costs a single byte.
+	 * Use rf24_send() to have this done from the IRQ instead.
 	 */
-	do
-	{       
-		delay_ms(1);
-		status = rf24_readout_register(r, OBSERVE_TX, &observe_tx, 1);
-		dbg("observe_tx: 0x%02x\n", status);
-	}
-	while( ! ( status & ( (1<<TX_DS) | (1<<MAX_RT) ) ) && ( timeout-- ) );
+	while (!((status = rf24_get_status(r)) & ((1<<TX_DS) | (1<<MAX_RT))) &&
+	       --timeout)
+		delay_us(RF24_POLL_US);
+	dbg("status: 0x%02x\n", status);
 
-	/* The part above is what you could recreate with your own interrupt handler,
-	 * and then call this when you got an interrupt
-	 * Call this when you get an interrupt
-	 * The status tells us three things
+	/* The status tells us three things
 	 *   -> The send was successful (TX_DS)
 	 *   -> The send failed, too many retries (MAX_RT)
          *   -> There is an ack packet waiting (RX_DR)
@@ -503,16 +577,161 @@ int rf24_write(struct rf24 *r, const void* buf, uint8_t len )
 		dbg("got %d bytes of ack length\n", r->ack_payload_length);
 	}
 	
-	/* Yay, we are done. */
-
-	rf24_power_down(r);
+	/* A payload that didn't make it stays in the FIFO */
+	if (!tx_ok)
+		rf24_flush_tx(r);
 
-	/* Flush buffers (Is this a relic of past experimentation, and not needed anymore??) */
-	rf24_flush_tx(r);
+	tx_idle(r);
 	
 	return ret;
 }
 
+#ifdef CONFIG_LIB_RF24_ASYNC
+
+/*
+ * The chip's TX FIFO only tells empty and full apart, so how many of
+ * the packets loaded are done is worked out from that: empty means
+ * all of them, not full at least all but two. With the queue kept
+ * topped up the FIFO is full again after every completion, so that's
+ * exact. The last two of a burst may only be reported once the FIFO
+ * drains. The TX_DS and MAX_RT interrupts are only used as a wakeup.
+ */
+
+#if RF24_TXQ_SIZE & (RF24_TXQ_SIZE - 1)
+#error "CONFIG_LIB_RF24_TXQ_SIZE must be a power of 2"
+#endif
+
+#define TXQ_INFLIGHT(r) CIRC_CNT((r)->tx_load, (r)->tx_tail, RF24_TXQ_SIZE)
+#define TXQ_WAITING(r)  CIRC_CNT((r)->tx_head, (r)->tx_load, RF24_TXQ_SIZE)
+
+static void tx_complete(struct rf24 *r, int n, int ok)
+{
+	while (n--) {
+		r->tx_tail = CIRC_NEXT(r->tx_tail, 1, RF24_TXQ_SIZE);
+		if (r->tx_done)
+			r->tx_done(r, ok);
+	}
+}
+
+/* Keep the chip's three TX FIFO slots full */
+static int tx_load(struct rf24 *r)
+{
+	int n = 0;
+	while (TXQ_INFLIGHT(r) < 3 && TXQ_WAITING(r)) {
+		struct rf24_packet *p = &r->txq[r->tx_load];
+		rf24_write_payload(r, p->data, p->len);
+		r->tx_load = CIRC_NEXT(r->tx_load, 1, RF24_TXQ_SIZE);
+		n++;
+	}
+	return n;
+}
+
+/*
+ * The chip has given up on the oldest packet in its FIFO and stopped.
+ * Find out how many it still has, fill it with a dummy to see if that
+ * fills it up, everything before is done. The failed one is dropped,
+ * the rest reloaded.
+ */
+static void tx_failed(struct rf24 *r)
+{
+	int left = 1, done;
+	uint8_t fifo = rf24_read_register(r, FIFO_STATUS);
+
+	if (fifo & (1<<FIFO_FULL)) {
+		left = 3;
+	} else if (TXQ_INFLIGHT(r) > 1) {
+		rf24_write_payload(r, "", 1);
+		if (rf24_get_status(r) & (1<<TX_FULL))
+			left = 2;
+	}
+	rf24_flush_tx(r);
+
+	/* Those after the failed one are waiting again */
+	done = TXQ_INFLIGHT(r) - left;
+	r->tx_load = CIRC_NEXT(r->tx_tail, done + 1, RF24_TXQ_SIZE);
+	tx_complete(r, done, 1);
+	tx_complete(r, 1, 0);
+}
+
+/**
+ * Queue a packet for the open writing pipe
+ *
+ * Returns at once. The packet is copied, sent from rf24_irq() when
+ * the ones before it are done, and r->tx_done() is called with the
+ * result. Don't mix with rf24_write() or listening.
+ *
+ * @param r rf24 instance to act upon
+ * @param buf Pointer to the data to be sent
+ * @param len Number of bytes to be sent, up to 32
+ * @return 0 if queued, -1 if the queue is full
+ */
+int rf24_send(struct rf24 *r, const void *buf, uint8_t len)
+{
+	struct rf24_packet *p;
+
+	if (!CIRC_SPACE(r->tx_head, r->tx_tail, RF24_TXQ_SIZE))
+		return -1;
+
+	p = &r->txq[r->tx_head];
+	p->len = min_t(uint8_t, len, sizeof(p->data));
+	memcpy(p->data, buf, p->len);
+	r->tx_head = CIRC_NEXT(r->tx_head, 1, RF24_TXQ_SIZE);
+
+	/*
+	 * If something is in flight rf24_irq() will pick it up. Otherwise
+	 * no interrupt can come, so the SPI is ours. CE goes up last.
+	 */
+	if (!TXQ_INFLIGHT(r)) {
+		tx_mode(r);
+		tx_load(r);
+		r->ce(1);
+	}
+	return 0;
+}
+
+/**
+ * Packets queued with rf24_send() and not reported done yet
+ *
+ * @param r rf24 instance to act upon
+ */
+int rf24_tx_pending(struct rf24 *r)
+{
+	return CIRC_CNT(r->tx_head, r->tx_tail, RF24_TXQ_SIZE);
+}
+
+/* The transmit side of rf24_irq() */
+static void tx_irq(struct rf24 *r, uint8_t status)
+{
+	uint8_t fifo;
+	int left;
+
+	if ((status & (1<<MAX_RT)) && TXQ_INFLIGHT(r))
+		tx_failed(r);
+
+	/* Clear before looking, so whatever completes later interrupts again */
+	if (status & ((1<<TX_DS) | (1<<MAX_RT)))
+		rf24_write_register(r, STATUS, status & ((1<<TX_DS) | (1<<MAX_RT)));
+	if (!TXQ_INFLIGHT(r) && !TXQ_WAITING(r))
+		return;
+
+	do {
+		fifo = rf24_read_register(r, FIFO_STATUS);
+		if (fifo & (1<<TX_EMPTY))
+			left = 0;
+		else if (fifo & (1<<FIFO_FULL))
+			left = 3;
+		else
+			left = 2;
+		if (TXQ_INFLIGHT(r) > left)
+			tx_complete(r, TXQ_INFLIGHT(r) - left, 1);
+	} while (tx_load(r) && TXQ_INFLIGHT(r) == 3);
+
+	if (!TXQ_INFLIGHT(r))
+		tx_idle(r);
+}
+
+#endif
+
 /**
  * Test whether there are bytes available to be read
  *
@@ -576,6 +795,157 @@ int rf24_read(struct rf24 *r, void* buf, uint8_t len )
 	return rf24_read_register(r, FIFO_STATUS) & (1<<RX_EMPTY);	
 }
 
+#ifdef CONFIG_LIB_RF24_RXQ
+
+#if RF24_RXQ_SIZE & (RF24_RXQ_SIZE - 1)
+#error "CONFIG_LIB_RF24_RXQ_SIZE must be a power of 2"
+#endif
+
+/* Whether a pipe's payloads carry their own length */
+static int rx_dynamic(struct rf24 *r, uint8_t pipe)
+{
+	return rf24_has_dynamic_payload(r) ||
+		((r->flags & RF24_ACK_PAYLOAD) && pipe < 2);
+}
+
+/**
+ * Move everything in the RX FIFO into the per pipe queues
+ *
+ * RX_DR is cleared once, first, so a payload arriving meanwhile still
+ * interrupts. After that the status byte clocked out with each read
+ * command tells which pipe the payload at the head is for, or that
+ * the FIFO is empty: one SPI transaction per payload, two with
+ * dynamic payloads, and one to find the FIFO empty.
+ * rf24_irq() calls this, or poll it.
+ *
+ * @param r rf24 instance to act upon
+ * @return Number of payloads taken from the FIFO
+ */
+int rf24_rx_drain(struct rf24 *r)
+{
+	uint8_t cmd = (r->flags & (RF24_DYNAMIC_PAYLOAD | RF24_ACK_PAYLOAD)) ?
+		R_RX_PL_WID : R_RX_PAYLOAD;
+	uint8_t status, pipe, len;
+	uint8_t scratch[32], *p;
+	struct rf24_rxq *q;
+	int n = 0;
+
+	status = rf24_write_register(r, STATUS, (1<<RX_DR));
+	if (((status >> RX_P_NO) & BIN(111)) > 5)
+		return 0;
+
+	for (;;) {
+		r->csn(0);
+		status = r->spi_xfer(cmd);
+		pipe = (status >> RX_P_NO) & BIN(111);
+		if (pipe > 5) {
+			r->csn(1);
+			break;
+		}
+
+		len = r->payload_size;
+		if (cmd == R_RX_PL_WID) {
+			uint8_t width = r->spi_xfer(0xff);
+			r->csn(1);
+			if (rx_dynamic(r, pipe))
+				len = width;
+			/* The datasheet says to throw away the lot */
+			if (len > 32) {
+				rf24_flush_rx(r);
+				break;
+			}
+			r->csn(0);
+			r->spi_xfer(R_RX_PAYLOAD);
+		}
+
+		q = pipe < RF24_RXQ_PIPES ? &r->rxq[pipe] : NULL;
+		if (q && CIRC_SPACE(q->head, q->tail, RF24_RXQ_SIZE)) {
+			p = q->slot[q->head].data;
+		} else {
+			p = scratch;
+			r->rx_dropped++;
+		}
+		xfer_data(r, NULL, p, len);
+		r->csn(1);
+
+		if (p != scratch) {
+			q->slot[q->head].len = len;
+			q->head = CIRC_NEXT(q->head, 1, RF24_RXQ_SIZE);
+		}
+		n++;
+	}
+	return n;
+}
+
+/**
+ * Take a payload from a pipe's queue
+ *
+ * @param r rf24 instance to act upon
+ * @param pipe Which pipe
+ * @param buf Where to put the data
+ * @param len Maximum number of bytes to copy
+ * @return Number of bytes copied, -1 if nothing was queued
+ */
+int rf24_recv(struct rf24 *r, uint8_t pipe, void *buf, uint8_t len)
+{
+	struct rf24_rxq *q;
+	struct rf24_packet *p;
+
+	if (pipe >= RF24_RXQ_PIPES)
+		return -1;
+	q = &r->rxq[pipe];
+	if (q->head == q->tail)
+		return -1;
+	p = &q->slot[q->tail];
+	len = min_t(uint8_t, len, p->len);
+	memcpy(buf, p->data, len);
+	q->tail = CIRC_NEXT(q->tail, 1, RF24_RXQ_SIZE);
+	return len;
+}
+
+/**
+ * Payloads waiting in a pipe's queue
+ *
+ * @param r rf24 instance to act upon
+ * @param pipe Which pipe
+ */
+int rf24_rx_pending(struct rf24 *r, uint8_t pipe)
+{
+	if (pipe >= RF24_RXQ_PIPES)
+		return 0;
+	return CIRC_CNT(r->rxq[pipe].head, r->rxq[pipe].tail, RF24_RXQ_SIZE);
+}
+
+#endif
+
+#if defined(CONFIG_LIB_RF24_ASYNC) || defined(CONFIG_LIB_RF24_RXQ)
+/**
+ * Service the radio's IRQ
+ *
+ * Call this from the IRQ pin interrupt (falling edge), or just poll it.
+ * Moves received payloads into the per pipe queues, completes what's
+ * been sent, refills the TX FIFO and idles the radio once the transmit
+ * queue is empty. Ack payloads are queued before tx_done() is called.
+ *
+ * Without LIB_RF24_RXQ, RX_DR is left alone: read ack payloads from
+ * r->tx_done() with rf24_available() and rf24_read(), or the IRQ line
+ * stays low.
+ *
+ * @param r rf24 instance to act upon
+ */
+void rf24_irq(struct rf24 *r)
+{
+	uint8_t status = rf24_get_status(r);
+#ifdef CONFIG_LIB_RF24_RXQ
+	if (status & (1<<RX_DR))
+		rf24_rx_drain(r);
+#endif
+#ifdef CONFIG_LIB_RF24_ASYNC
+	tx_irq(r, status);
+#endif
+}
+#endif
+
 /**
  * Open a pipe for writing
  *
@@ -668,7 +1038,7 @@ void rf24_open_reading_pipe(struct rf24 *r, uint8_t child, uint8_t *address)
 		 */
 		rf24_write_register(r, 
 				    EN_RXADDR, 
-				    rf24_read_register(r, EN_RXADDR) | 
+				    *shadow(r, EN_RXADDR) | 
 				    child_pipe_enable[child]
 			);
 	}
@@ -790,10 +1160,11 @@ static void write_feature(struct rf24 *r, uint8_t v)
  */
 void rf24_enable_ack_payload(struct rf24 *r)
 {
-	write_feature(r, rf24_read_register(r, FEATURE) | 
+	write_feature(r, *shadow(r, FEATURE) | 
 		      (1<<EN_ACK_PAY) | (1<<EN_DPL) 
 		);
-	rf24_write_register(r, DYNPD, rf24_read_register(r, DYNPD) | (1 << DPL_P1) | (1 << DPL_P0));
+	rf24_write_register(r, DYNPD, *shadow(r, DYNPD) | (1 << DPL_P1) | (1 << DPL_P0));
+	r->flags |= RF24_ACK_PAYLOAD;
 }
 
 /**
@@ -806,7 +1177,7 @@ void rf24_enable_ack_payload(struct rf24 *r)
  */
 void rf24_enable_dynamic_payloads(struct rf24 *r)
 {
-	write_feature(r, rf24_read_register(r, FEATURE) | 
+	write_feature(r, *shadow(r, FEATURE) | 
 		      (1<<EN_DPL) 
 		);
 	/* Enable dynamic payload on all pipes
@@ -815,7 +1186,7 @@ void rf24_enable_dynamic_payloads(struct rf24 *r)
 	 * pipes, so the library does not support it.
 	 */
 	
-	rf24_write_register(r, DYNPD, rf24_read_register(r, DYNPD) | 
+	rf24_write_register(r, DYNPD, *shadow(r, DYNPD) | 
 			    (1<<DPL_P5) | (1<<DPL_P4) | (1<<DPL_P3) | (1<<DPL_P2) | (1<<DPL_P1) | (1<<DPL_P0));
 	
 	r->flags |= RF24_DYNAMIC_PAYLOAD;
@@ -852,7 +1223,7 @@ void rf24_set_pipe_auto_ack(struct rf24 *r, uint8_t pipe, int enable )
 {
 	if ( pipe <= 6 )
 	{
-		uint8_t en_aa = rf24_read_register(r, EN_AA ) ;
+		uint8_t en_aa = *shadow(r, EN_AA);
 		if( enable )
 		{
 			en_aa |= (1<<pipe) ;
@@ -878,7 +1249,7 @@ void rf24_set_pipe_auto_ack(struct rf24 *r, uint8_t pipe, int enable )
  */
 void rf24_set_pa_level( struct rf24 *r, rf24_pa_dbm_e level ) 
 {
-	uint8_t setup = rf24_read_register(r, RF_SETUP) ;
+	uint8_t setup = *shadow(r, RF_SETUP);
 	setup &= ~((1<<RF_PWR_LOW) | (1<<RF_PWR_HIGH)) ;
 	
 	/* switch uses RAM (evil!) */
@@ -920,7 +1291,7 @@ void rf24_set_pa_level( struct rf24 *r, rf24_pa_dbm_e level )
 rf24_pa_dbm_e rf24_get_pa_level( struct rf24 *r ) 
 {
 	rf24_pa_dbm_e result = RF24_PA_ERROR ;
-	uint8_t power = rf24_read_register(r, RF_SETUP) & 
+	uint8_t power = *shadow(r, RF_SETUP) & 
 		((1<<RF_PWR_LOW) | (1<<RF_PWR_HIGH)) ;
 
 	/* switch uses RAM (evil!) */
@@ -956,7 +1327,7 @@ rf24_pa_dbm_e rf24_get_pa_level( struct rf24 *r )
 int rf24_set_data_rate(struct rf24 *r, rf24_datarate_e speed)
 {
 	int result = 0;
-	uint8_t setup = rf24_read_register(r, RF_SETUP) ;
+	uint8_t setup = *shadow(r, RF_SETUP);
 
 	/* HIGH and LOW '00' is 1Mbs - our default */
 	r->flags &= ~(RF24_WIDE_BAND);
@@ -987,8 +1358,9 @@ int rf24_set_data_rate(struct rf24 *r, rf24_datarate_e speed)
 	}
 	rf24_write_register(r, RF_SETUP, setup);
 
-	/* Verify our result */
-	if ( rf24_read_register(r, RF_SETUP) == setup )
+	/* Verify our result, on the chip: non-P ones don't take 250kbps */
+	*shadow(r, RF_SETUP) = rf24_read_register(r, RF_SETUP);
+	if ( *shadow(r, RF_SETUP) == setup )
 	{
 		result = 1;
 	}
@@ -1010,7 +1382,7 @@ int rf24_set_data_rate(struct rf24 *r, rf24_datarate_e speed)
 rf24_datarate_e rf24_get_data_rate( struct rf24 *r )
 {
 	rf24_datarate_e result ;
-	uint8_t dr = rf24_read_register(r, RF_SETUP) & 
+	uint8_t dr = *shadow(r, RF_SETUP) & 
 		((1<<RF_DR_LOW) | (1<<RF_DR_HIGH));
 	
 	/* switch uses RAM (evil!)
@@ -1043,7 +1415,7 @@ rf24_datarate_e rf24_get_data_rate( struct rf24 *r )
 
 void rf24_set_crc_length(struct rf24 *r, rf24_crclength_e length)
 {
-	uint8_t config = rf24_read_register(r, CONFIG) & 
+	uint8_t config = *shadow(r, CONFIG) & 
 		~( (1<<CRCO) | (1<<EN_CRC)) ;
   
 	/* switch uses RAM (evil!) */
@@ -1072,7 +1444,7 @@ void rf24_set_crc_length(struct rf24 *r, rf24_crclength_e length)
 rf24_crclength_e rf24_get_crc_length(struct rf24 *r)
 {
 	rf24_crclength_e result = RF24_CRC_DISABLED;
-	uint8_t config = rf24_read_register(r, CONFIG) & ( (1<<CRCO) | (1<<EN_CRC)) ;
+	uint8_t config = *shadow(r, CONFIG) & ( (1<<CRCO) | (1<<EN_CRC)) ;
 
 	if ( config & (1<<EN_CRC ) )
 	{
@@ -1092,7 +1464,7 @@ rf24_crclength_e rf24_get_crc_length(struct rf24 *r)
  */
 void rf24_disable_crc( struct rf24 *r ) 
 {
-	uint8_t disable = rf24_read_register(r, CONFIG) & ~(1<<EN_CRC) ;
+	uint8_t disable = *shadow(r, CONFIG) & ~(1<<EN_CRC) ;
 	rf24_write_register(r,  CONFIG, disable ) ;	
 }
 
@@ -1149,7 +1521,7 @@ void rf24_print_details(struct rf24 *r)
 void rf24_power_down(struct rf24 *r)
 {
 	rf24_write_register(r, CONFIG, 
-			    rf24_read_register(r, CONFIG) & ~(1<<PWR_UP));
+			    *shadow(r, CONFIG) & ~(1<<PWR_UP));
 }
 
 /**
@@ -1161,7 +1533,7 @@ void rf24_power_down(struct rf24 *r)
 void rf24_power_up(struct rf24 *r)
 {
 		rf24_write_register(r, CONFIG, 
-			    rf24_read_register(r, CONFIG) | (1<<PWR_UP));
+			    *shadow(r, CONFIG) | (1<<PWR_UP));
 }
 
 
@@ -1182,9 +1554,7 @@ void rf24_power_up(struct rf24 *r)
 void rf24_start_write(struct rf24 *r, const void* buf, uint8_t len )
 {
 	/* Transmitter power-up */
-	rf24_write_register(r, CONFIG, 
-			    ( rf24_read_register(r, CONFIG) | (1<<PWR_UP) ) & ~(1<<PRIM_RX) );
-	delay_us(150);
+	tx_mode(r);
 	
 	/* Send the payload */
 	rf24_write_payload( r, buf, len );
@@ -1212,14 +1582,11 @@ void rf24_start_write(struct rf24 *r, const void* buf, uint8_t len )
  */
 void rf24_write_ack_payload(struct rf24 *r, uint8_t pipe, const void* buf, uint8_t len)
 {
-	const uint8_t* current = (const uint8_t*)(buf);
-	
+	const uint8_t max_payload_size = 32;
+
 	r->csn(0);
 	r->spi_xfer( W_ACK_PAYLOAD | ( pipe & BIN(111) ) );
-	const uint8_t max_payload_size = 32;
-	uint8_t data_len = min_t(uint8_t, len, max_payload_size);
-	while ( data_len-- )
-		r->spi_xfer(*current++);	
+	xfer_data(r, buf, NULL, min_t(uint8_t, len, max_payload_size));
 	r->csn(1);
 }
 
@@ -1278,3 +1645,17 @@ int rf24_test_rpd(struct rf24 *r)
 { 
 	return ( rf24_read_register(r, RPD) & 1 ) ;
 }
+
+/**
+ * Choose what the radio does once there's nothing more to send
+ *
+ * Applies to rf24_write() and the rf24_send() queue. The default is
+ * RF24_IDLE_STANDBY.
+ *
+ * @param r rf24 instance to act upon
+ * @param mode One of rf24_idle_e
+ */
+void rf24_set_idle_mode(struct rf24 *r, rf24_idle_e mode)
+{
+	r->idle_mode = mode;
+}
@@ -0,0 +1,212 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <arch/antares.h>
+#include <generic/macros.h>
+#include <lib/xmodem.h>
+
+/*
+ * Runs a sender and a receiver against each other over a pair of
+ * pipes, the sender in a child process. Checks a clean transfer, one
+ * with a corrupted byte with and without the receiver starting first,
+ * a writer that fails and a sender that goes quiet halfway.
+ *
+ * A "second" is 100 ms here, and delay_1s() returns as soon as
+ * something comes in, the way a UART driver waiting on its receive
+ * interrupt would.
+ */
+
+#define SIZE    CONFIG_LIB_XMODEM_BENCH_BYTES
+#define SECOND  100
+
+static int to_rx[2], to_tx[2];
+static char src[SIZE], dst[SIZE + 1024];
+static long spos, dpos, sent, corrupt, cut, fail_at;
+static int outstanding, errors;
+
+static int get(int fd)
+{
+	unsigned char c;
+	if (read(fd, &c, 1) != 1)
+		return -1;
+	return c;
+}
+
+static int ready(int fd, int ms)
+{
+	struct pollfd p = { fd, POLLIN, 0 };
+	return poll(&p, 1, ms) > 0 && (p.revents & POLLIN);
+}
+
+static int tx_getc(void)
+{
+	return get(to_tx[0]);
+}
+
+static void tx_putc(char c)
+{
+	if (cut && sent >= cut)
+		return;
+	if (++sent == corrupt)
+		c ^= 0x40;
+	if (write(to_rx[1], &c, 1) != 1)
+		return;
+}
+
+static int tx_avail()
+{
+	return ready(to_tx[0], 0);
+}
+
+static void tx_delay()
+{
+	ready(to_tx[0], SECOND);
+}
+
+static int reader(char *buf, int size)
+{
+	/* Not what was asked for, fill() has to cope */
+	long n = min_t(long, SIZE - spos, min_t(int, size, 700));
+	memcpy(buf, &src[spos], n);
+	spos += n;
+	return n;
+}
+
+static int rx_getc(void)
+{
+	return get(to_rx[0]);
+}
+
+static void rx_putc(char c)
+{
+	if (write(to_tx[1], &c, 1) != 1)
+		return;
+}
+
+static int rx_avail()
+{
+	return ready(to_rx[0], 0);
+}
+
+static void rx_delay()
+{
+	ready(to_rx[0], SECOND);
+}
+
+static int writer(char *buf, int size)
+{
+	if (outstanding)
+		errors++;
+	if (fail_at && dpos >= fail_at)
+		return -1;
+	memcpy(&dst[dpos], buf, size);
+	dpos += size;
+	outstanding = 1;
+	return size;
+}
+
+static void writer_wait(void)
+{
+	outstanding = 0;
+}
+
+/*
+ * The sender starts 'early' seconds after the receiver. Returns what
+ * xmodem_receive() did, what xmodem_transmit() did goes in *tx.
+ */
+static int run(const char *what, int early, int *tx)
+{
+	struct xmodem_receiver r = {
+		rx_getc, rx_putc, rx_avail, rx_delay, writer, writer_wait
+	};
+	struct xmodem_transmitter t = {
+		tx_getc, tx_putc, tx_avail, tx_delay, reader
+	};
+	int ret, status;
+	pid_t pid;
+
+	spos = dpos = sent = 0;
+	memset(dst, 0, sizeof(dst));
+	if (pipe(to_rx) || pipe(to_tx)) {
+		perror("pipe");
+		exit(1);
+	}
+	fflush(stdout);
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		exit(1);
+	}
+	if (!pid) {
+		signal(SIGPIPE, SIG_IGN);
+		usleep(early * SECOND * 1000);
+		ret = xmodem_transmit(&t);
+		exit(ret < 0 ? -ret : 0);
+	}
+
+	ret = xmodem_receive(&r);
+	close(to_rx[0]);
+	close(to_tx[1]);
+	waitpid(pid, &status, 0);
+	close(to_rx[1]);
+	close(to_tx[0]);
+	*tx = WIFEXITED(status) ? -WEXITSTATUS(status) : -100;
+	if (!*tx)
+		*tx = SIZE;
+
+	printf("%-34s rx %6d tx %6d %s\n", what, ret, *tx,
+	       memcmp(src, dst, SIZE) ? "" : "match");
+	if (outstanding) {
+		printf("%-34s writer still busy: FAILED\n", what);
+		errors++;
+	}
+	return ret;
+}
+
+static void expect(const char *what, int ok)
+{
+	if (!ok) {
+		printf("%-34s FAILED\n", what);
+		errors++;
+	}
+}
+
+ANTARES_APP(xmodem_bench)
+{
+	int rx, tx, i;
+
+	for (i = 0; i < SIZE; i++)
+		src[i] = rand();
+	printf("xmodem-bench: %d bytes over pipes\n", SIZE);
+
+	rx = run("clean", 0, &tx);
+	expect("clean", rx >= SIZE && tx == SIZE && !memcmp(src, dst, SIZE));
+
+	corrupt = 5000;
+	rx = run("one byte corrupted", 0, &tx);
+	expect("one byte corrupted",
+	       rx >= SIZE && tx == SIZE && !memcmp(src, dst, SIZE));
+
+	/* It's said 'C' a few times by the time the sender is there */
+	rx = run("receiver first, one byte corrupted", 3, &tx);
+	expect("receiver first, one byte corrupted",
+	       rx >= SIZE && tx == SIZE && !memcmp(src, dst, SIZE));
+	corrupt = 0;
+
+	fail_at = SIZE / 2;
+	rx = run("writer fails halfway", 0, &tx);
+	expect("writer fails halfway", rx == -4 && tx == -1);
+	fail_at = 0;
+
+	cut = 5000;
+	rx = run("sender goes quiet halfway", 0, &tx);
+	expect("sender goes quiet halfway", rx == -3 && tx < 0);
+	cut = 0;
+
+	printf("xmodem-bench: %s\n", errors ? "FAILED" : "all good");
+	exit(errors ? 1 : 0);
+}
@@ -1,6 +1,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <lib/xmodem.h>
+#include <lib/crc.h>
 #include <stdint.h>
 
 #define SOH  0x01
@@ -11,287 +12,292 @@
 #define CAN  0x18
 #define CTRLZ 0x1A
 
-#define DLY_1S 100000
 #define MAXRETRANS 25
+#define SYNC_TRIES 16
 
+/* 
+ * Two packets: one is with the writer, the next one comes into the 
+ * other. Or, sending, one is on the wire while the reader fills the
+ * other. Static, this is too much for most stacks. One pair per
+ * direction, so a receive and a transmit can run at once, e.g. on
+ * two ports. With --gc-sections only the ones in use take RAM.
+ */
+static char rxbuf[2][1024];
+static char txbuf[2][1024];
 
-static int (*_writer)(unsigned char* buffer, int size);
-
-void xmodem_init(int (*writer)(unsigned char* buffer, int size))
+static void flushinput(int (*getc)(void), int (*avail)())
 {
-	_writer = writer;
+	if (avail)
+		while (avail())
+			getc();
 }
 
+static void cancel(int (*getc)(void), void (*putc)(char c), int (*avail)())
+{
+	flushinput(getc, avail);
+	putc(CAN);
+	putc(CAN);
+	putc(CAN);
+}
 
-unsigned short crc16(const unsigned char *buf, int sz)
+/* Whether anything came in within a second, or just yes if we can't tell */
+static int wait_1s(int (*avail)(), void (*delay_1s)())
 {
-        unsigned short crc = 0;
-        while (--sz >= 0)
-        {
-                int i;
-                crc ^= (unsigned short) *buf++ << 8;
-                for (i = 0; i < 8; i++)
-                        if (crc & 0x8000)
-                                crc = crc << 1 ^ 0x1021;
-			else
-				crc <<= 1;
-        }
-        return crc;
+	if (!avail || !delay_1s || avail())
+		return 1;
+	delay_1s();
+	return avail();
 }
 
+/* The next byte, or -1 if there's none within a second */
+static int getc_1s(struct xmodem_receiver *rx)
+{
+	if (!wait_1s(rx->char_avail, rx->delay_1s))
+		return -1;
+	return rx->getchar();
+}
 
-static int check(int crc, const unsigned char *buf, int sz)
+int xmodem_receive(struct xmodem_receiver *rx)
 {
-	if (crc)
-	{
-		unsigned short crc = crc16(buf, sz);
-		unsigned short tcrc = (buf[sz]<<8)+buf[sz+1];
-		if (crc == tcrc)
-			return 1;
+	unsigned char packetno = 1, blk, nblk;
+	unsigned short crc, tcrc;
+	int use_crc = 1, retry, errors = 0;
+	int c, i, bufsz, len = 0, cur = 0, ret, writing = 0;
+	char *p;
+
+	/* Ask for CRCs, fall back to checksums if the sender won't answer */
+	for (retry = 0; ; retry++) {
+		if (retry == SYNC_TRIES)
+			use_crc = 0;
+		if (retry == 2 * SYNC_TRIES) {
+			cancel(rx->getchar, rx->putchar, rx->char_avail);
+			return -2; /* sync error */
+		}
+		rx->putchar(use_crc ? 'C' : NAK);
+		if (wait_1s(rx->char_avail, rx->delay_1s))
+			break;
 	}
-	else
-	{
-		int i;
-		unsigned char cks = 0;
-		for (i = 0; i < sz; ++i)
-		{
-			cks += buf[i];
+
+	for (;;) {
+		switch (getc_1s(rx)) {
+		case SOH:
+			bufsz = 128;
+			break;
+		case STX:
+			bufsz = 1024;
+			break;
+		case EOT:
+			rx->putchar(ACK);
+			ret = len; /* normal end */
+			goto out;
+		case CAN:
+			if (getc_1s(rx) == CAN) {
+				rx->putchar(ACK);
+				ret = -1; /* canceled by remote */
+				goto out;
+			}
+			continue;
+		case -1:
+			goto reject; /* Nothing for a second */
+		default:
+			continue; /* Noise between packets */
+		}
+
+		/* Check as it comes in, there's no time for a second pass */
+		if ((c = getc_1s(rx)) < 0)
+			goto reject;
+		blk = c;
+		if ((c = getc_1s(rx)) < 0)
+			goto reject;
+		nblk = c;
+		p = rxbuf[cur];
+		crc = 0;
+		for (i = 0; i < bufsz; i++) {
+			if ((c = getc_1s(rx)) < 0)
+				goto reject;
+			p[i] = c;
+			crc = use_crc ? crc16_ccitt_byte(crc, c) : crc + (c & 0xff);
+		}
+		if ((c = getc_1s(rx)) < 0)
+			goto reject;
+		tcrc = c & 0xff;
+		if (use_crc) {
+			if ((c = getc_1s(rx)) < 0)
+				goto reject;
+			tcrc = (tcrc << 8) | (c & 0xff);
+		} else {
+			crc &= 0xff;
 		}
-		if (cks == buf[sz])
-			return 1;
+
+		if (blk != (unsigned char) ~nblk || crc != tcrc ||
+		    (blk != packetno && blk != (unsigned char) (packetno - 1)))
+			goto reject;
+
+		/* Good. The sender can go on while we write it out */
+		rx->putchar(ACK);
+		if (blk != packetno)
+			continue; /* Our last ACK got lost */
+		packetno++;
+		errors = 0;
+
+		/* The other buffer must be done with before we start on this one */
+		if (writing && rx->writer_wait)
+			rx->writer_wait();
+		writing = 1;
+		if (rx->writer(p, bufsz) < 0) {
+			cancel(rx->getchar, rx->putchar, rx->char_avail);
+			ret = -4; /* write error */
+			goto out;
+		}
+		len += bufsz;
+		cur ^= 1;
+		continue;
+
+	reject:
+		/* Bad, cut short or missing: have it again */
+		if (++errors > MAXRETRANS) {
+			cancel(rx->getchar, rx->putchar, rx->char_avail);
+			ret = -3; /* too many retry error */
+			goto out;
+		}
+		flushinput(rx->getchar, rx->char_avail);
+		rx->putchar(NAK);
 	}
 
-	return 0;
+out:
+	/* Don't return while the writer still holds a buffer */
+	if (writing && rx->writer_wait)
+		rx->writer_wait();
+	return ret;
+}
+
+static int fill(struct xmodem_transmitter *tx, char *buf)
+{
+	int n = 0, ret;
+	/* A short read is only the end if the reader says so */
+	while (n < 1024) {
+		ret = tx->reader(&buf[n], 1024 - n);
+		if (ret < 0)
+			return ret;
+		if (!ret)
+			break;
+		n += ret;
+	}
+	return n;
+}
+
+/*
+ * The receiver's reply: ACK, NAK, CAN if it cancelled, or -1 if there's
+ * none within 10 seconds. Anything else is noise, or a 'C' it sent
+ * before it saw the first packet, skip it.
+ */
+static int reply(struct xmodem_transmitter *tx)
+{
+	int i = 0, c;
+	while (i < 10) {
+		if (!wait_1s(tx->char_avail, tx->delay_1s)) {
+			i++;
+			continue;
+		}
+		c = tx->getchar();
+		if (c == ACK || c == NAK)
+			return c;
+		if (c == CAN && wait_1s(tx->char_avail, tx->delay_1s) &&
+		    tx->getchar() == CAN)
+			return CAN;
+	}
+	return -1;
 }
 
-static void flushinput(void)
+static void send_packet(struct xmodem_transmitter *tx, unsigned char packetno,
+			const char *data, int len, int bufsz, int use_crc)
 {
-	while (try_getc() >= 0);
+	unsigned short crc = 0;
+	unsigned char c;
+	int i;
+
+	tx->putchar(bufsz == 1024 ? STX : SOH);
+	tx->putchar(packetno);
+	tx->putchar(~packetno);
+	for (i = 0; i < bufsz; i++) {
+		c = (i < len) ? data[i] : CTRLZ;
+		tx->putchar(c);
+		crc = use_crc ? crc16_ccitt_byte(crc, c) : crc + c;
+	}
+	if (use_crc)
+		tx->putchar(crc >> 8);
+	tx->putchar(crc);
 }
 
-int xmodem_get(unsigned char *dest, int destsz)
+int xmodem_transmit(struct xmodem_transmitter *tx)
 {
-	unsigned char xbuff[1030]; /* 1024 for XModem 1k + 3 head chars + 2 crc + nul */
-	unsigned char *p;
-	int bufsz, crc = 0;
-	unsigned char trychar = 'C';
 	unsigned char packetno = 1;
-	int i, c, len = 0;
-	int retry, retrans = MAXRETRANS;
+	int use_crc, retry, c, off, bufsz, len = 0;
+	int cur = 0, n, next = 0, fetched;
+	char *p;
 
-	for (;;)
-	{
-		for ( retry = 0; retry < 160; ++retry)
-		{
-			if (trychar)
-			{
-				putchar(trychar);
-				//      sleep(0x008f0000);
-			}
-			if ((c = try_getc((DLY_1S)<<1)) >= 0)
-			{
-				switch (c)
-				{
-				case SOH:
-					bufsz = 128;
-					goto start_recv;
-				case STX:
-					bufsz = 1024;
-					goto start_recv;
-				case EOT:
-					flushinput();
-					putchar(ACK);
-					return len; /* normal end */
-				case CAN:
-					if ((c = try_getc(DLY_1S)) == CAN)
-					{
-						flushinput();
-						putchar(ACK);
-						return -1; /* canceled by remote */
-					}
-					break;
-				default:
-					break;
-				}
-			}
+	for (retry = 0; ; retry++) {
+		if (retry == 6 * SYNC_TRIES) {
+			cancel(tx->getchar, tx->putchar, tx->char_avail);
+			return -2; /* no sync */
 		}
-		if (trychar == 'C')
-		{
-			trychar = NAK;
+		if (!wait_1s(tx->char_avail, tx->delay_1s))
 			continue;
+		c = tx->getchar();
+		if (c == 'C' || c == NAK)
+			break;
+		if (c == CAN && tx->getchar() == CAN) {
+			tx->putchar(ACK);
+			return -1; /* canceled by remote */
 		}
-		flushinput();
-		putchar(CAN);
-		putchar(CAN);
-		putchar(CAN);
-		return -2; /* sync error */
-
-	start_recv:
-		if (trychar == 'C') crc = 1;
-		trychar = 0;
-		p = xbuff;
-		*p++ = c;
-		for (i = 0;  i < (bufsz+(crc?1:0)+3); ++i)
-		{
-			if ((c = try_getc(DLY_1S)) < 0) goto reject;
-			*p++ = c;
-		}
+	}
+	use_crc = (c == 'C');
+	/* It may have asked more than once, those aren't replies */
+	flushinput(tx->getchar, tx->char_avail);
 
-		if (xbuff[1] == (unsigned char)(~xbuff[2]) &&
-		    (xbuff[1] == packetno || xbuff[1] == (unsigned char)packetno-1) &&
-		    check(crc, &xbuff[3], bufsz))
-		{
-			if (xbuff[1] == packetno)
-			{
-				unsigned int count = destsz - len;
-				if (count > bufsz) count = bufsz;
-				if (count > 0)
-				{
-					//memcpy (&dest[len], &xbuff[3], count);
-					_writer(&xbuff[3], count);
-					len += count;
+	n = fill(tx, txbuf[cur]);
+	while (n > 0) {
+		p = txbuf[cur];
+		fetched = 0;
+		/* 1K packets need CRCs, checksums get 128 byte ones */
+		for (off = 0; off < n; off += bufsz) {
+			bufsz = (use_crc && n - off > 128) ? 1024 : 128;
+			for (retry = 0; ; retry++) {
+				if (retry == MAXRETRANS) {
+					cancel(tx->getchar, tx->putchar, tx->char_avail);
+					return -4; /* xmit error */
 				}
-				++packetno;
-				retrans = MAXRETRANS+1;
-			}
-			if (--retrans <= 0)
-			{
-				flushinput();
-				putchar(CAN);
-				putchar(CAN);
-				putchar(CAN);
-				return -3; /* too many retry error */
+				send_packet(tx, packetno, &p[off], n - off, bufsz, use_crc);
+				/* Get the next chunk while this one is on the wire */
+				if (!fetched && off + bufsz >= n) {
+					next = fill(tx, txbuf[cur ^ 1]);
+					fetched = 1;
+				}
+				c = reply(tx);
+				if (c == ACK)
+					break;
+				if (c == CAN) {
+					tx->putchar(ACK);
+					return -1; /* canceled by remote */
+				}
+				/* NAK or nothing, send it again */
 			}
-			putchar(ACK);
-			continue;
+			packetno++;
 		}
-	reject:
-		flushinput();
-		putchar(NAK);
+		len += n;
+		cur ^= 1;
+		n = next;
 	}
-}
-/*
-  int xmodemTransmit(unsigned char *src, int srcsz)
-  {
-  //unsigned char xbuff[1030]; // 1024 for XModem 1k + 3 head chars + 2 crc + nul 
-  int bufsz, crc = -1;
-  unsigned char packetno = 1;
-  int i, c, len = 0;
-  int retry;
 
-  for (;;)
-  {
-  for ( retry = 0; retry < 16; ++retry)
-  {
-  if ((c = dbgu_getc_nonblock((DLY_1S)<<1)) >= 0)
-  {
-  switch (c)
-  {
-  case 'C':
-  crc = 1;
-  goto start_trans;
-  case NAK:
-  crc = 0;
-  goto start_trans;
-  case CAN:
-  if ((c = dbgu_getc_nonblock(DLY_1S)) == CAN)
-  {
-  putchar(ACK);
-  flushinput();
-  return -1; // canceled by remote 
-  }
-  break;
-  default:
-  break;
-  }
-  }
-  }
-  putchar(CAN);
-  putchar(CAN);
-  putchar(CAN);
-  flushinput();
-  return -2; // no sync 
+	if (n < 0) {
+		cancel(tx->getchar, tx->putchar, tx->char_avail);
+		return -6; /* read error */
+	}
 
-  for (;;)
-  {
-  start_trans:
-  xbuff[0] = SOH;
-  bufsz = 128;
-  xbuff[1] = packetno;
-  xbuff[2] = ~packetno;
-  c = srcsz - len;
-  if (c > bufsz) c = bufsz;
-  if (c >= 0)
-  {
-  memset (&xbuff[3], 0, bufsz);
-  if (c == 0)
-  {
-  xbuff[3] = CTRLZ;
-  }
-  else
-  {
-  memcpy (&xbuff[3], &src[len], c);
-  if (c < bufsz) xbuff[3+c] = CTRLZ;
-  }
-  if (crc)
-  {
-  unsigned short ccrc = crc16(&xbuff[3], bufsz);
-  xbuff[bufsz+3] = (ccrc>>8) & 0xFF;
-  xbuff[bufsz+4] = ccrc & 0xFF;
-  }
-  else
-  {
-  unsigned char ccks = 0;
-  for (i = 3; i < bufsz+3; ++i)
-  {
-  ccks += xbuff[i];
-  }
-  xbuff[bufsz+3] = ccks;
-  }
-  for (retry = 0; retry < MAXRETRANS; ++retry)
-  {
-  for (i = 0; i < bufsz+4+(crc?1:0); ++i)
-  {
-  putchar(xbuff[i]);
-  }
-  if ((c = dbgu_getc_nonblock(DLY_1S)) >= 0 )
-  {
-  switch (c)
-  {
-  case ACK:
-  ++packetno;
-  len += bufsz;
-  goto start_trans;
-  case CAN:
-  if ((c = dbgu_getc_nonblock(DLY_1S)) == CAN)
-  {
-  putchar(ACK);
-  flushinput();
-  return -1; // canceled by remote 
-  }
-  break;
-  case NAK:
-  default:
-  break;
-  }
-  }
-  }
-  putchar(CAN);
-  putchar(CAN);
-  putchar(CAN);
-  flushinput();
-  return -4; // xmit error 
-  }
-  else
-  {
-  for (retry = 0; retry < 10; ++retry)
-  {
-  putchar(EOT);
-  if ((c = dbgu_getc_nonblock((DLY_1S)<<1)) == ACK) break;
-  }
-  flushinput();
-  return (c == ACK)?len:-5;
-  }
-  }
-  }
-  }*/
+	for (retry = 0; retry < 10; retry++) {
+		tx->putchar(EOT);
+		if (reply(tx) == ACK)
+			return len;
+	}
+	return -5; /* no ACK for EOT */
+}
@@ -147,4 +147,10 @@ $(IMAGENAME).bin: $(IMAGENAME).elf
 $(IMAGENAME).lss: $(IMAGENAME).elf
 	$(SILENT_DISAS) $(OBJDUMP) -h -S $< > $@
 
+ifeq ($(CONFIG_LIB_PRINTK_BINARY),y)
+BUILDGOALS+=$(IMAGENAME).printk
+$(IMAGENAME).printk: $(IMAGENAME).elf
+	$(SILENT_GEN) $(ANTARES_DIR)/scripts/printk_decode table $< > $@
+endif
+
 PHONY+=builtin